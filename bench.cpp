@@ -0,0 +1,535 @@
+﻿#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include "cxx-timer.h"
+using namespace utility::timer;
+
+// every result is a line of key=value pairs, e.g.
+// bench=contention queue=wheel mode=async threads=4 ops_per_sec=...
+// so the runs of backends and commits can be compared by scripts.
+
+// count the heap allocations and the live bytes of the whole process.
+static std::atomic<uint64_t> g_allocations{ 0 };
+static std::atomic<int64_t> g_live_bytes{ 0 };
+
+// the size is kept in front of the block for operator delete.
+static constexpr size_t alloc_header = 16;
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_live_bytes.fetch_add(static_cast<int64_t>(size),
+                           std::memory_order_relaxed);
+    if (auto ptr = static_cast<char*>(std::malloc(size + alloc_header)))
+    {
+        *reinterpret_cast<std::size_t*>(ptr) = size;
+        return ptr + alloc_header;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    auto block = static_cast<char*>(ptr) - alloc_header;
+    g_live_bytes.fetch_sub(
+        static_cast<int64_t>(*reinterpret_cast<std::size_t*>(block)),
+        std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+namespace
+{
+
+struct bench_config
+{
+    int ops{ 100000 };
+    size_t max_pending{ 1000000 };
+    int max_threads{ 64 };
+    std::string only;
+
+    bool enabled(const char* bench) const
+    {
+        return only.empty() || only == bench;
+    }
+};
+
+int64_t now_ns()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+// create/cancel contention: every producer arms a long timeout
+// and cancels it, like a request-timeout in a server.
+template <typename Mgr>
+void bench_contention(const char* queue, const char* mode, bool async_submit,
+                      int threads, int count)
+{
+    timer_options options;
+    options.async_submit = async_submit;
+    Mgr mgr(options);
+
+    std::vector<std::vector<int64_t>> latency(threads);
+    std::vector<std::thread> producers;
+
+    auto t0 = now_ns();
+    for (auto i = 0; i < threads; ++i)
+    {
+        producers.emplace_back([&mgr, &latency, i, count]()
+        {
+            auto& result = latency[i];
+            result.reserve(count);
+
+            for (auto j = 0; j < count; ++j)
+            {
+                auto t1 = now_ns();
+                auto id = mgr.create_timer(60 * 1000, []() {});
+                mgr.cancel_timer(id);
+                result.push_back(now_ns() - t1);
+            }
+        });
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    auto elapsed = now_ns() - t0;
+
+    std::vector<int64_t> all;
+    for (auto& result : latency)
+    {
+        all.insert(all.end(), result.begin(), result.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    // no samples of --ops=0.
+    auto at = [&all](size_t percent)
+    {
+        return all.empty() ? 0 : all[all.size() * percent / 100];
+    };
+
+    auto ops = static_cast<double>(threads) * count;
+    std::cout << "bench=contention queue=" << queue
+              << " mode=" << mode
+              << " threads=" << threads
+              << " ops=" << static_cast<int64_t>(ops)
+              << " ops_per_sec=" << static_cast<int64_t>(ops * 1e9 / elapsed)
+              << " p50_ns=" << at(50)
+              << " p99_ns=" << at(99)
+              << " max_ns=" << (all.empty() ? 0 : all.back())
+              << std::endl;
+}
+
+// heap allocations per operation on the steady state,
+// the timer objects are reused from the pool after warm up.
+template <typename Mgr>
+void bench_allocations(const char* queue, const char* mode,
+                       bool async_submit, int count)
+{
+    timer_options options;
+    options.async_submit = async_submit;
+    Mgr mgr(options);
+
+    auto create_cancel = [&mgr, count]()
+    {
+        for (auto i = 0; i < count; ++i)
+        {
+            mgr.cancel_timer(mgr.create_timer(60 * 1000, []() {}));
+        }
+
+        // let the schedule thread free the canceled timers.
+        mgr.create_timer(0, []() {});
+        std::this_thread::sleep_for(std::chrono::milliseconds(70));
+    };
+
+    // warm up the pool.
+    create_cancel();
+
+    auto allocations = g_allocations.load();
+    create_cancel();
+    allocations = g_allocations.load() - allocations;
+
+    std::cout << "bench=allocations queue=" << queue
+              << " op=create_cancel mode=" << mode
+              << " ops=" << count
+              << " allocs_per_op="
+              << static_cast<double>(allocations) / count
+              << std::endl;
+
+    std::atomic_int fired{ 0 };
+    auto create_fire = [&mgr, &fired, count]()
+    {
+        for (auto i = 0; i < count; ++i)
+        {
+            mgr.create_timer(1, [&fired]() { fired.fetch_add(1); });
+        }
+
+        while (fired.load() < count)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        fired.store(0);
+    };
+
+    create_fire();
+
+    allocations = g_allocations.load();
+    create_fire();
+    allocations = g_allocations.load() - allocations;
+
+    std::cout << "bench=allocations queue=" << queue
+              << " op=create_fire mode=" << mode
+              << " ops=" << count
+              << " allocs_per_op="
+              << static_cast<double>(allocations) / count
+              << std::endl;
+
+    auto stats = mgr.stats();
+    std::cout << "bench=batches queue=" << queue
+              << " mode=" << mode
+              << " batches=" << stats.batches
+              << " events=" << stats.batched_events
+              << " max_batch=" << stats.max_batch
+              << std::endl;
+}
+
+// arm a cohort of timers in one burst(e.g. on startup or failover),
+// one by one and by the bulk api, then cancel them.
+template <typename Mgr>
+void bench_cohort(const char* queue, const char* mode, bool async_submit,
+                  int count)
+{
+    timer_options options;
+    options.async_submit = async_submit;
+
+    std::vector<timer_spec> specs(count);
+    for (auto i = 0; i < count; ++i)
+    {
+        specs[i].interval = std::chrono::milliseconds(60 * 1000 + i % 1000);
+    }
+    std::vector<timer_id_t> ids(count);
+
+    {
+        Mgr mgr(options);
+
+        auto t0 = now_ns();
+        for (auto i = 0; i < count; ++i)
+        {
+            ids[i] = mgr.create_timer(specs[i], []() {});
+        }
+        auto t1 = now_ns();
+        for (auto i = 0; i < count; ++i)
+        {
+            mgr.cancel_timer(ids[i]);
+        }
+        auto t2 = now_ns();
+
+        std::cout << "bench=cohort queue=" << queue
+                  << " api=single mode=" << mode
+                  << " timers=" << count
+                  << " create_ms=" << (t1 - t0) / 1000000.0
+                  << " cancel_ms=" << (t2 - t1) / 1000000.0
+                  << std::endl;
+    }
+
+    {
+        Mgr mgr(options);
+        std::vector<timer_callback> cbs(count);
+        for (auto& cb : cbs)
+        {
+            cb = []() {};
+        }
+
+        auto t0 = now_ns();
+        mgr.create_timers(specs.data(), cbs.data(), count, ids.data());
+        auto t1 = now_ns();
+        mgr.cancel_timers(ids.data(), count);
+        auto t2 = now_ns();
+
+        std::cout << "bench=cohort queue=" << queue
+                  << " api=bulk mode=" << mode
+                  << " timers=" << count
+                  << " create_ms=" << (t1 - t0) / 1000000.0
+                  << " cancel_ms=" << (t2 - t1) / 1000000.0
+                  << std::endl;
+    }
+}
+
+// fire throughput with n pending timers spread over a second, driven by
+// advance() so only the scheduler and the dispatch are measured.
+// the live bytes of the armed timers give the memory per timer.
+template <typename Mgr>
+void bench_fire(const char* queue, size_t pending)
+{
+    timer_options options;
+    options.manual_drive = true;
+
+    auto bytes = g_live_bytes.load();
+    Mgr mgr(options);
+
+    uint64_t fired = 0;
+    auto t0 = now_ns();
+    for (size_t i = 0; i < pending; ++i)
+    {
+        auto delay = std::chrono::microseconds(
+            1000 + static_cast<int64_t>(i * 7919 % 1000000));
+        mgr.create_timer(delay, [&fired]() { ++fired; });
+    }
+    auto t1 = now_ns();
+    bytes = g_live_bytes.load() - bytes;
+
+    // fire in 1ms steps like an event loop catching up.
+    auto now = detail::tick_count_us();
+    auto end = now + 1001 * 1000;
+    while (fired < pending && now < end)
+    {
+        now += 1000;
+        mgr.advance(now);
+    }
+    auto t2 = now_ns();
+
+    std::cout << "bench=fire queue=" << queue
+              << " pending=" << pending
+              << " fired=" << fired
+              << " create_ms=" << (t1 - t0) / 1000000.0
+              << " fire_ms=" << (t2 - t1) / 1000000.0
+              << " events_per_sec="
+              << static_cast<int64_t>(fired * 1e9 / (t2 - t1 + 1))
+              << " bytes_per_timer="
+              << static_cast<double>(bytes) / pending
+              << std::endl;
+}
+
+// the firing lateness of repeat timers of a interval on the threads mode.
+template <typename Mgr>
+void bench_lateness(const char* queue, const char* mode,
+                    int executor_threads, int64_t interval_usec)
+{
+#ifndef UTILITY_TIMER_NO_STATS
+    timer_options options;
+    options.executor_threads = executor_threads;
+    Mgr mgr(options);
+
+    // 100 timers with staggered phases about 300ms.
+    const auto timers = 100;
+    auto repeat = static_cast<int32_t>(
+        std::max<int64_t>(3, 300 * 1000 / interval_usec));
+
+    std::atomic<int64_t> fired{ 0 };
+    for (auto i = 0; i < timers; ++i)
+    {
+        timer_spec spec;
+        spec.interval = std::chrono::microseconds(
+            interval_usec + i * interval_usec / timers);
+        spec.repeat = repeat;
+        mgr.create_timer(spec, [&fired]() { fired.fetch_add(1); });
+    }
+
+    auto total = static_cast<int64_t>(timers) * repeat;
+    while (fired.load() < total)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    auto stats = mgr.stats();
+    auto& lateness = stats.lateness;
+    std::cout << "bench=lateness queue=" << queue
+              << " mode=" << mode
+              << " interval_us=" << interval_usec
+              << " events=" << lateness.count()
+              << " p50_us=" << lateness.percentile(50)
+              << " p99_us=" << lateness.percentile(99)
+              << " p999_us=" << lateness.percentile(99.9)
+              << " max_us=" << lateness.max()
+              << " queue_delay_p99_us=" << stats.queue_delay.percentile(99)
+              << " wakeups=" << stats.wakeups
+              << std::endl;
+#else
+    (void)queue;
+    (void)mode;
+    (void)executor_threads;
+    (void)interval_usec;
+#endif
+}
+
+// the process cpu time while n timers are pending far in the future,
+// a idle timer should sleep and not burn cpu.
+template <typename Mgr>
+void bench_idle(const char* queue, const char* mode, bool async_submit,
+                size_t pending)
+{
+    timer_options options;
+    options.async_submit = async_submit;
+    Mgr mgr(options);
+
+    for (size_t i = 0; i < pending; ++i)
+    {
+        mgr.create_timer(60 * 1000 + static_cast<int32_t>(i % 1000),
+                         []() {});
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    auto wakeups = mgr.stats().wakeups;
+    auto cpu = std::clock();
+    auto t0 = now_ns();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto elapsed = now_ns() - t0;
+    cpu = std::clock() - cpu;
+
+    std::cout << "bench=idle queue=" << queue
+              << " mode=" << mode
+              << " pending=" << pending
+              << " cpu_percent="
+              << 100.0 * cpu / CLOCKS_PER_SEC / (elapsed / 1e9)
+              << " wakeups=" << mgr.stats().wakeups - wakeups
+              << std::endl;
+}
+
+template <typename Mgr>
+void run_benches(const char* queue, const bench_config& config)
+{
+    auto count = config.ops;
+
+    if (config.enabled("contention"))
+    {
+        // every thread does one op at least.
+        for (auto threads = 1; threads <= config.max_threads; threads *= 2)
+        {
+            auto per_thread = std::max(count / threads, 1);
+            bench_contention<Mgr>(queue, "mutex", false, threads,
+                                  per_thread);
+            bench_contention<Mgr>(queue, "async", true, threads,
+                                  per_thread);
+        }
+    }
+
+    if (config.enabled("allocations"))
+    {
+        bench_allocations<Mgr>(queue, "mutex", false, count);
+        bench_allocations<Mgr>(queue, "async", true, count);
+    }
+
+    if (config.enabled("cohort"))
+    {
+        // a cohort of 1M timers by default.
+        bench_cohort<Mgr>(queue, "mutex", false, count * 10);
+        bench_cohort<Mgr>(queue, "async", true, count * 10);
+    }
+
+    if (config.enabled("fire"))
+    {
+        for (size_t pending = 1000; pending <= config.max_pending;
+             pending *= 10)
+        {
+            bench_fire<Mgr>(queue, pending);
+        }
+    }
+
+    if (config.enabled("lateness"))
+    {
+        for (auto interval : { 200, 1000, 10000 })
+        {
+            bench_lateness<Mgr>(queue, "event_thread", 1, interval);
+            bench_lateness<Mgr>(queue, "event_pool", 4, interval);
+        }
+    }
+
+    if (config.enabled("idle"))
+    {
+        bench_idle<Mgr>(queue, "mutex", false, 10000);
+        bench_idle<Mgr>(queue, "async", true, 10000);
+    }
+}
+
+bool parse_option(const char* arg, const char* name, std::string& value)
+{
+    auto length = std::strlen(name);
+    if (std::strncmp(arg, name, length) != 0 || arg[length] != '=')
+    {
+        return false;
+    }
+
+    value = arg + length + 1;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench_config config;
+    std::string queue;
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        std::string value;
+        if (parse_option(argv[i], "--ops", value))
+        {
+            config.ops = std::stoi(value);
+        }
+        else if (parse_option(argv[i], "--max-pending", value))
+        {
+            config.max_pending = std::stoull(value);
+        }
+        else if (parse_option(argv[i], "--max-threads", value))
+        {
+            config.max_threads = std::stoi(value);
+        }
+        else if (parse_option(argv[i], "--only", value))
+        {
+            config.only = value;
+        }
+        else if (parse_option(argv[i], "--queue", value))
+        {
+            queue = value;
+        }
+        else if (argv[i][0] != '-')
+        {
+            config.ops = std::stoi(argv[i]);
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--ops=N] [--max-pending=N] [--max-threads=N]"
+                      << " [--only=contention|allocations|cohort|fire|"
+                      << "lateness|idle] [--queue=map|wheel|heap]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (queue.empty() || queue == "map")
+    {
+        run_benches<detail::map_timer_mgr>("map", config);
+    }
+
+    if (queue.empty() || queue == "wheel")
+    {
+        run_benches<detail::wheel_timer_mgr>("wheel", config);
+    }
+
+    if (queue.empty() || queue == "heap")
+    {
+        run_benches<detail::heap_timer_mgr>("heap", config);
+    }
+
+    return 0;
+}
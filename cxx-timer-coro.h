@@ -0,0 +1,319 @@
+﻿/*
+
+Copyright (c) 2024 lemon19900815@buerjia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#ifndef __UTILITY_TIMER_CORO_H__
+#define __UTILITY_TIMER_CORO_H__
+
+// C++20 coroutine support of cxx-timer.h, include it only when the
+// coroutines are enabled(-std=c++20 or /std:c++20).
+#if !defined(__cpp_impl_coroutine)
+#error "cxx-timer-coro.h requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+
+#include "cxx-timer.h"
+
+namespace utility
+{
+namespace timer
+{
+
+// awaiter of sleep_for: the awaiter lives in the coroutine frame and the
+// timer callback only keeps the coroutine handle inline, an await never
+// allocates. the coroutine is resumed on the executor thread of the
+// timer(or inside advance in manual_drive mode).
+//
+// co_await returns false if the timer is shut down and never resumes
+// the coroutine later, the coroutines waiting on the timers dropped
+// by shutdown are never resumed.
+class sleep_awaiter
+{
+public:
+    sleep_awaiter(timer_iface& timer, std::chrono::microseconds delay)
+        : timer_(timer), delay_(delay)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        // the coroutine may be resumed before create_timer returns,
+        // the awaiter is not touched once the timer is created.
+        auto id = timer_.create_timer(delay_,
+                                      [handle]() { handle.resume(); });
+        if (id < 0)
+        {
+            closed_ = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool await_resume() const noexcept { return !closed_; }
+
+private:
+    timer_iface& timer_;
+    std::chrono::microseconds delay_;
+    bool closed_{ false };
+};
+
+// co_await sleep_for(timer, 10ms), the delay is rounded up to microsecond.
+template <typename Rep, typename Period>
+sleep_awaiter sleep_for(timer_iface& timer,
+                        const std::chrono::duration<Rep, Period>& delay)
+{
+    return sleep_awaiter(
+        timer, std::chrono::ceil<std::chrono::microseconds>(delay));
+}
+
+// sleep on the singleton timer.
+template <typename Rep, typename Period>
+sleep_awaiter sleep_for(const std::chrono::duration<Rep, Period>& delay)
+{
+    return sleep_for(timer_iface::get(), delay);
+}
+
+namespace detail
+{
+
+// the awaiter type of co_await a expression of type A.
+template <typename A>
+decltype(auto) get_awaiter(A&& awaitable)
+{
+    if constexpr (requires { std::forward<A>(awaitable).operator
+                                 co_await(); })
+    {
+        return std::forward<A>(awaitable).operator co_await();
+    }
+    else if constexpr (requires { operator co_await(
+                                      std::forward<A>(awaitable)); })
+    {
+        return operator co_await(std::forward<A>(awaitable));
+    }
+    else
+    {
+        return std::forward<A>(awaitable);
+    }
+}
+
+template <typename A>
+using await_result_t = decltype(
+    get_awaiter(std::declval<A>()).await_resume());
+
+// result of with_timeout: bool for a void awaitable, std::optional of
+// the value otherwise, empty(or false) if timed out.
+template <typename T>
+struct timeout_result
+{
+    using type = std::optional<std::decay_t<T>>;
+};
+
+template <>
+struct timeout_result<void>
+{
+    using type = bool;
+};
+
+// shared by the awaiter, the timer and the coroutine driving the
+// awaitable, the first finished one resumes the awaiting coroutine.
+template <typename T>
+struct timeout_state
+{
+    typename timeout_result<T>::type result{};
+    std::exception_ptr error;
+    std::coroutine_handle<> handle;
+    timer_id_t timer_id{ -1 };
+    std::atomic_bool finished{ false };
+
+    bool finish()
+    {
+        return !finished.exchange(true, std::memory_order_acq_rel);
+    }
+};
+
+// a eager coroutine destroyed itself at the end, it keeps the awaitable
+// alive after the timeout until it completes.
+struct timeout_driver
+{
+    struct promise_type
+    {
+        timeout_driver get_return_object()
+        {
+            return timeout_driver{
+                std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename A>
+timeout_driver drive_timeout(timer_iface* timer, A awaitable,
+                             std::shared_ptr<timeout_state<await_result_t<A>>>
+                                 state)
+{
+    using result_type = await_result_t<A>;
+
+    // the loser of the race never touches the result.
+    typename timeout_result<result_type>::type result{};
+    std::exception_ptr error;
+    try
+    {
+        if constexpr (std::is_void_v<result_type>)
+        {
+            co_await std::move(awaitable);
+            result = true;
+        }
+        else
+        {
+            result.emplace(co_await std::move(awaitable));
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    if (!state->finish())
+    {
+        co_return;
+    }
+
+    state->result = std::move(result);
+    state->error = error;
+    timer->cancel_timer(state->timer_id);
+    state->handle.resume();
+}
+
+// awaiter of with_timeout.
+template <typename A>
+class timeout_awaiter
+{
+public:
+    using result_type = typename timeout_result<await_result_t<A>>::type;
+
+    timeout_awaiter(timer_iface& timer, A awaitable,
+                    std::chrono::microseconds timeout)
+        : timer_(timer), awaitable_(std::move(awaitable)), timeout_(timeout)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        // the driver owns the awaitable and the state, the awaiter is
+        // not touched once the timer is created.
+        auto state = std::make_shared<timeout_state<await_result_t<A>>>();
+        state->handle = handle;
+        state_ = state;
+
+        auto driver = drive_timeout(&timer_, std::move(awaitable_), state);
+        auto id = timer_.create_timer(timeout_, [state]()
+        {
+            if (state->finish())
+            {
+                state->handle.resume();
+            }
+        });
+
+        if (id < 0)
+        {
+            // the timer is shut down, time out at once.
+            driver.handle.destroy();
+            return false;
+        }
+
+        state->timer_id = id;
+
+        // timed out already, the awaitable is never started.
+        if (state->finished.load(std::memory_order_acquire))
+        {
+            driver.handle.destroy();
+            return true;
+        }
+
+        driver.handle.resume();
+        return true;
+    }
+
+    result_type await_resume()
+    {
+        if (state_->error)
+        {
+            std::rethrow_exception(state_->error);
+        }
+
+        return std::move(state_->result);
+    }
+
+private:
+    timer_iface& timer_;
+    A awaitable_;
+    std::chrono::microseconds timeout_;
+    std::shared_ptr<timeout_state<await_result_t<A>>> state_;
+};
+
+} // namespace detail
+
+// co_await with_timeout(timer, awaitable, 10ms) races the awaitable with a
+// timer: returns std::optional of the result(bool for void), empty if
+// timed out. the awaiting coroutine is resumed by the first finished, a
+// timed out awaitable still runs to completion and its result is dropped.
+// unlike sleep_for an await allocates twice: the shared state(the timer
+// callback may run after the awaiting coroutine is resumed) and the frame
+// of the coroutine driving the awaitable(it outlives a timeout).
+template <typename A, typename Rep, typename Period>
+detail::timeout_awaiter<std::decay_t<A>> with_timeout(
+    timer_iface& timer, A&& awaitable,
+    const std::chrono::duration<Rep, Period>& timeout)
+{
+    return detail::timeout_awaiter<std::decay_t<A>>(
+        timer, std::forward<A>(awaitable),
+        std::chrono::ceil<std::chrono::microseconds>(timeout));
+}
+
+// race with the singleton timer.
+template <typename A, typename Rep, typename Period>
+detail::timeout_awaiter<std::decay_t<A>> with_timeout(
+    A&& awaitable, const std::chrono::duration<Rep, Period>& timeout)
+{
+    return with_timeout(timer_iface::get(), std::forward<A>(awaitable),
+                        timeout);
+}
+
+} // namespace timer
+} // namespace utility
+
+#endif // __UTILITY_TIMER_CORO_H__
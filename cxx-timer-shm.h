@@ -0,0 +1,1135 @@
+﻿/*
+
+Copyright (c) 2024 lemon19900815@buerjia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#ifndef __UTILITY_TIMER_SHM_H__
+#define __UTILITY_TIMER_SHM_H__
+
+// a timer service shared by the processes of a host: one daemon process
+// schedules the timers of all processes, a process attaches to it and is
+// woken by a futex only when its timers fire, instead of a scheduler
+// thread of its own per process.
+#if !defined(__linux__)
+#error "cxx-timer-shm.h requires Linux"
+#endif
+
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "cxx-timer.h"
+
+namespace utility
+{
+namespace timer
+{
+
+// the shared segment options, set by the daemon.
+struct shm_timer_options
+{
+    // the pending timers of all processes.
+    uint32_t capacity{ 16384 };
+    // the processes attached at once.
+    uint32_t max_clients{ 64 };
+    // the submission ring of create/cancel commands, a power of 2.
+    uint32_t ring_size{ 4096 };
+    // the daemon schedule thread, "timer-shm" by default.
+    timer_thread_options schedule_thread;
+};
+
+namespace detail
+{
+
+// the atomics of the segment are shared by processes, a lock-based one
+// would lock a mutex of the process only.
+#if defined(__cpp_lib_atomic_is_always_lock_free)
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<int32_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "the shared atomics must be lock-free");
+#else
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2 &&
+              ATOMIC_LLONG_LOCK_FREE == 2,
+              "the shared atomics must be lock-free");
+#endif
+
+// futex of a shared word, FUTEX_WAIT(not PRIVATE) works across processes.
+inline void shm_futex_wait(std::atomic<uint32_t>* word, uint32_t value,
+                           int32_t msec)
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                  "futex needs a plain 32 bits word");
+
+    timespec timeout{ msec / 1000, (msec % 1000) * 1000000L };
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT,
+              value, msec < 0 ? nullptr : &timeout, nullptr, 0);
+}
+
+inline void shm_futex_wake(std::atomic<uint32_t>* word)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE,
+              1, nullptr, nullptr, 0);
+}
+
+// a command of the submission ring.
+struct shm_command
+{
+    enum : uint32_t { create, cancel, detach };
+
+    uint32_t op;
+    uint32_t client;
+    uint32_t slot;
+    uint32_t gen;
+    int64_t interval;
+    int32_t repeat;
+};
+
+// a cell of the bounded multi-producer ring(Vyukov), seq is the
+// position it is ready to be written at, or to be read at + 1.
+// a client killed between the claim of a cell and the store of seq(a few
+// instructions without a syscall) leaves the cell unpublished forever,
+// the daemon can't tell it from a slow writer and stops consuming the
+// commands, it must be restarted then.
+struct shm_cell
+{
+    std::atomic<uint64_t> seq;
+    shm_command command;
+};
+
+// a timer of the shared table, owned by one client.
+struct shm_slot
+{
+    // the fired flag of a last fire or a cancel, the slot is released
+    // by the client after it.
+    static constexpr uint32_t done = 0x80000000;
+    static constexpr uint32_t end = 0xffffffff;
+
+    // the link of the free list or the fired list of the owner.
+    std::atomic<uint32_t> next;
+    // the fires not dispatched by the owner, with the done flag.
+    std::atomic<uint32_t> fired;
+    // the client index + 1, 0 if free.
+    std::atomic<uint32_t> owner;
+    std::atomic<uint32_t> gen;
+};
+
+// a attached process.
+struct alignas(64) shm_client
+{
+    std::atomic<int32_t> pid;
+    // 1 while the client sleeps on it.
+    std::atomic<uint32_t> waiting;
+    // the fired slots pushed by the daemon, taken at once by the client.
+    std::atomic<uint32_t> fired_head;
+};
+
+struct alignas(64) shm_header
+{
+    static constexpr uint32_t magic_value = 0x544d5348;
+
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t max_clients;
+    uint32_t ring_size;
+    // set once the segment is initialized.
+    std::atomic<uint32_t> ready;
+    // 1 while the daemon sleeps on it.
+    std::atomic<uint32_t> waiting;
+    // the free slots, a tag in the high 32 bits against ABA.
+    std::atomic<uint64_t> free_head;
+    alignas(64) std::atomic<uint64_t> ring_head;
+    // read by the daemon only.
+    alignas(64) uint64_t ring_tail;
+};
+
+// the memory-mapped segment: header, clients, ring cells and slots.
+class shm_segment
+{
+public:
+    shm_segment() = default;
+    shm_segment(const shm_segment&) = delete;
+    shm_segment& operator=(const shm_segment&) = delete;
+
+    ~shm_segment();
+
+    // the daemon creates the segment, a stale one of a exited daemon is
+    // replaced, false(errno EEXIST) if a daemon of name is alive.
+    bool create(const std::string& name, const shm_timer_options& options);
+    // a client maps the segment of a running daemon.
+    bool open(const std::string& name);
+
+    shm_header& header() { return *header_; }
+    shm_client& client(uint32_t index) { return clients_[index]; }
+    shm_slot& slot(uint32_t index) { return slots_[index]; }
+
+    // any process pushes, false if the ring is full.
+    bool push(const shm_command& command);
+    // the daemon pops, false if the ring is empty.
+    bool pop(shm_command& command);
+    bool ring_empty() const;
+
+    // the slots shared by all processes, shm_slot::end if none.
+    uint32_t alloc_slot(uint32_t client);
+    void free_slot(uint32_t index);
+
+    // the daemon pushes a fire of a slot to its owner, a fired slot is
+    // linked once until the owner takes it.
+    void push_fired(uint32_t index, uint32_t fired);
+
+private:
+    static size_t layout(const shm_timer_options& options, size_t* clients,
+                         size_t* cells, size_t* slots);
+
+    bool map(int fd, size_t size);
+
+private:
+    std::string name_;
+    bool owner_{ false };
+    // the daemon holds the flock of name.lock while it's alive, the lock
+    // file is never removed, so two daemons always lock the same file.
+    int lock_fd_{ -1 };
+    // the segment file created, name may refer to another one later.
+    dev_t dev_{ 0 };
+    ino_t ino_{ 0 };
+    void* base_{ nullptr };
+    size_t size_{ 0 };
+
+    shm_header* header_{ nullptr };
+    shm_client* clients_{ nullptr };
+    shm_cell* cells_{ nullptr };
+    shm_slot* slots_{ nullptr };
+};
+
+inline shm_segment::~shm_segment()
+{
+    if (base_ != nullptr)
+    {
+        ::munmap(base_, size_);
+    }
+
+    if (owner_)
+    {
+        // unlink the name only if it still refers to our segment.
+        struct stat st;
+        auto fd = ::shm_open(name_.c_str(), O_RDONLY, 0600);
+        if (fd >= 0 && ::fstat(fd, &st) == 0 && st.st_dev == dev_ &&
+            st.st_ino == ino_)
+        {
+            ::shm_unlink(name_.c_str());
+        }
+
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    if (lock_fd_ >= 0)
+    {
+        ::close(lock_fd_); // releases the flock.
+    }
+}
+
+inline size_t shm_segment::layout(const shm_timer_options& options,
+                                  size_t* clients, size_t* cells,
+                                  size_t* slots)
+{
+    auto align = [](size_t size) { return (size + 63) & ~size_t(63); };
+
+    *clients = align(sizeof(shm_header));
+    *cells = align(*clients + sizeof(shm_client) * options.max_clients);
+    *slots = align(*cells + sizeof(shm_cell) * options.ring_size);
+    return align(*slots + sizeof(shm_slot) * options.capacity);
+}
+
+inline bool shm_segment::map(int fd, size_t size)
+{
+    base_ = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base_ == MAP_FAILED)
+    {
+        base_ = nullptr;
+        return false;
+    }
+
+    size_ = size;
+    return true;
+}
+
+inline bool shm_segment::create(const std::string& name,
+                                const shm_timer_options& options)
+{
+    if (options.capacity == 0 || options.capacity >= shm_slot::end ||
+        options.max_clients == 0 || options.ring_size < 2 ||
+        (options.ring_size & (options.ring_size - 1)) != 0)
+    {
+        return false;
+    }
+
+    size_t clients, cells, slots;
+    auto size = layout(options, &clients, &cells, &slots);
+
+    // the flock is released by the kernel when a daemon exits, a segment
+    // left without it is stale.
+    lock_fd_ = ::shm_open((name + ".lock").c_str(), O_RDWR | O_CREAT, 0600);
+    if (lock_fd_ < 0)
+    {
+        return false;
+    }
+
+    if (::flock(lock_fd_, LOCK_EX | LOCK_NB) != 0)
+    {
+        errno = EEXIST; // a live daemon owns the segment.
+        return false;
+    }
+
+    ::shm_unlink(name.c_str());
+    auto fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    name_ = name;
+    owner_ = true;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (!map(fd, size))
+    {
+        return false;
+    }
+
+    auto base = static_cast<char*>(base_);
+    header_ = new (base) shm_header();
+    clients_ = reinterpret_cast<shm_client*>(base + clients);
+    cells_ = reinterpret_cast<shm_cell*>(base + cells);
+    slots_ = reinterpret_cast<shm_slot*>(base + slots);
+
+    header_->magic = shm_header::magic_value;
+    header_->capacity = options.capacity;
+    header_->max_clients = options.max_clients;
+    header_->ring_size = options.ring_size;
+    header_->ring_head.store(0);
+    header_->ring_tail = 0;
+
+    for (uint32_t i = 0; i < options.max_clients; ++i)
+    {
+        new (&clients_[i]) shm_client();
+        clients_[i].pid.store(0);
+        clients_[i].waiting.store(0);
+        clients_[i].fired_head.store(shm_slot::end);
+    }
+
+    for (uint32_t i = 0; i < options.ring_size; ++i)
+    {
+        new (&cells_[i]) shm_cell();
+        cells_[i].seq.store(i);
+    }
+
+    for (uint32_t i = 0; i < options.capacity; ++i)
+    {
+        new (&slots_[i]) shm_slot();
+        slots_[i].next.store(i + 1 < options.capacity ? i + 1 : shm_slot::end);
+        slots_[i].fired.store(0);
+        slots_[i].owner.store(0);
+        slots_[i].gen.store(0);
+    }
+
+    header_->free_head.store(0);
+    header_->ready.store(1, std::memory_order_release);
+    return true;
+}
+
+inline bool shm_segment::open(const std::string& name)
+{
+    auto fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(shm_header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (!map(fd, static_cast<size_t>(st.st_size)))
+    {
+        return false;
+    }
+
+    header_ = static_cast<shm_header*>(base_);
+    if (header_->ready.load(std::memory_order_acquire) != 1 ||
+        header_->magic != shm_header::magic_value)
+    {
+        return false;
+    }
+
+    shm_timer_options options;
+    options.capacity = header_->capacity;
+    options.max_clients = header_->max_clients;
+    options.ring_size = header_->ring_size;
+
+    size_t clients, cells, slots;
+    if (layout(options, &clients, &cells, &slots) > size_)
+    {
+        return false;
+    }
+
+    auto base = static_cast<char*>(base_);
+    clients_ = reinterpret_cast<shm_client*>(base + clients);
+    cells_ = reinterpret_cast<shm_cell*>(base + cells);
+    slots_ = reinterpret_cast<shm_slot*>(base + slots);
+    return true;
+}
+
+inline bool shm_segment::push(const shm_command& command)
+{
+    auto mask = header_->ring_size - 1;
+    auto pos = header_->ring_head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        auto& cell = cells_[pos & mask];
+        auto seq = cell.seq.load(std::memory_order_acquire);
+        auto diff = static_cast<int64_t>(seq - pos);
+        if (diff == 0)
+        {
+            if (header_->ring_head.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.command = command;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = header_->ring_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+inline bool shm_segment::pop(shm_command& command)
+{
+    auto pos = header_->ring_tail;
+    auto& cell = cells_[pos & (header_->ring_size - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+    {
+        return false;
+    }
+
+    command = cell.command;
+    cell.seq.store(pos + header_->ring_size, std::memory_order_release);
+    header_->ring_tail = pos + 1;
+    return true;
+}
+
+inline bool shm_segment::ring_empty() const
+{
+    auto pos = header_->ring_tail;
+    auto& cell = cells_[pos & (header_->ring_size - 1)];
+    return cell.seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+inline uint32_t shm_segment::alloc_slot(uint32_t client)
+{
+    auto head = header_->free_head.load(std::memory_order_acquire);
+    for (;;)
+    {
+        auto index = static_cast<uint32_t>(head);
+        if (index == shm_slot::end)
+        {
+            return shm_slot::end;
+        }
+
+        // a stale next fails the tag check of the exchange.
+        auto next = slots_[index].next.load(std::memory_order_relaxed);
+        auto tag = (head >> 32) + 1;
+        if (header_->free_head.compare_exchange_weak(
+                head, (tag << 32) | next, std::memory_order_acq_rel,
+                std::memory_order_acquire))
+        {
+            auto& slot = slots_[index];
+            slot.fired.store(0, std::memory_order_relaxed);
+            slot.gen.store((slot.gen.load() + 1) & 0x7fffffff,
+                           std::memory_order_relaxed);
+            slot.owner.store(client + 1, std::memory_order_release);
+            return index;
+        }
+    }
+}
+
+inline void shm_segment::free_slot(uint32_t index)
+{
+    auto& slot = slots_[index];
+    slot.owner.store(0, std::memory_order_relaxed);
+
+    auto head = header_->free_head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot.next.store(static_cast<uint32_t>(head),
+                        std::memory_order_relaxed);
+        auto tag = (head >> 32) + 1;
+        if (header_->free_head.compare_exchange_weak(
+                head, (tag << 32) | index, std::memory_order_acq_rel,
+                std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
+
+inline void shm_segment::push_fired(uint32_t index, uint32_t fired)
+{
+    auto& slot = slots_[index];
+    auto owner = slot.owner.load(std::memory_order_acquire);
+    if (owner == 0)
+    {
+        return;
+    }
+
+    // linked already, the owner takes the fires with it.
+    if (slot.fired.fetch_add(fired, std::memory_order_acq_rel) != 0)
+    {
+        return;
+    }
+
+    auto& client = clients_[owner - 1];
+    auto head = client.fired_head.load(std::memory_order_relaxed);
+    do
+    {
+        slot.next.store(head, std::memory_order_relaxed);
+    } while (!client.fired_head.compare_exchange_weak(head, index));
+
+    if (client.waiting.exchange(0) != 0)
+    {
+        shm_futex_wake(&client.waiting);
+    }
+}
+
+} // namespace detail
+
+// the daemon of a shared segment, it runs the schedule thread of all
+// attached processes. the segment is removed when the daemon exits.
+class shm_timer_daemon
+{
+public:
+    shm_timer_daemon(const shm_timer_daemon&) = delete;
+    shm_timer_daemon& operator=(const shm_timer_daemon&) = delete;
+
+    ~shm_timer_daemon();
+
+    // create the segment of name(e.g. "/my-timer") and start the schedule
+    // thread, nullptr if failed.
+    static std::unique_ptr<shm_timer_daemon> create(
+        const std::string& name,
+        const shm_timer_options& options = shm_timer_options());
+
+    // the pending timers of all processes.
+    size_t pending_timers() const { return pending_.load(); }
+
+private:
+    shm_timer_daemon();
+
+    static timer_options manual_options();
+
+    void run(timer_thread_options options);
+    void drain();
+    void fire(uint32_t index, uint32_t missed);
+    void detach(uint32_t client);
+    void reap();
+
+private:
+    static constexpr int32_t reap_msec = 1000;
+
+    detail::shm_segment segment_;
+    // the scheduler of the daemon thread, only the table and the
+    // commands are shared.
+    detail::timer_mgr mgr_;
+    // the local timer and the repeats left of the slots.
+    std::vector<timer_id_t> ids_;
+    std::vector<int32_t> remaining_;
+    std::atomic<size_t> pending_{ 0 };
+
+    std::atomic_bool stop_{ false };
+    std::thread schedule_thd_;
+};
+
+inline shm_timer_daemon::shm_timer_daemon() : mgr_(manual_options()) {}
+
+inline timer_options shm_timer_daemon::manual_options()
+{
+    timer_options options;
+    options.manual_drive = true;
+    return options;
+}
+
+inline shm_timer_daemon::~shm_timer_daemon()
+{
+    if (schedule_thd_.joinable())
+    {
+        stop_.store(true);
+        segment_.header().waiting.store(0);
+        detail::shm_futex_wake(&segment_.header().waiting);
+        schedule_thd_.join();
+    }
+}
+
+inline std::unique_ptr<shm_timer_daemon> shm_timer_daemon::create(
+    const std::string& name, const shm_timer_options& options)
+{
+    std::unique_ptr<shm_timer_daemon> daemon(new shm_timer_daemon());
+    if (!daemon->segment_.create(name, options))
+    {
+        return nullptr;
+    }
+
+    daemon->ids_.assign(options.capacity, -1);
+    daemon->remaining_.assign(options.capacity, 0);
+    daemon->schedule_thd_ = std::thread(&shm_timer_daemon::run,
+                                        daemon.get(),
+                                        options.schedule_thread);
+    return daemon;
+}
+
+inline void shm_timer_daemon::run(timer_thread_options options)
+{
+    detail::apply_thread_options(options, "timer-shm");
+
+    auto& header = segment_.header();
+    int32_t reap_period = reap_msec;
+    auto reap_at = std::chrono::steady_clock::now();
+    while (!stop_.load())
+    {
+        drain();
+        mgr_.advance();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= reap_at)
+        {
+            reap();
+            reap_at = now + std::chrono::milliseconds(reap_period);
+        }
+
+        auto timeout = mgr_.next_timeout();
+        if (timeout == 0)
+        {
+            continue;
+        }
+
+        // the clients wake the daemon if they see waiting, the ring is
+        // checked again after it is set.
+        header.waiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!segment_.ring_empty() || stop_.load())
+        {
+            header.waiting.store(0);
+            continue;
+        }
+
+        timeout = timeout < 0 ? reap_period : std::min(timeout, reap_period);
+        detail::shm_futex_wait(&header.waiting, 1, timeout);
+        header.waiting.store(0);
+    }
+}
+
+inline void shm_timer_daemon::drain()
+{
+    detail::shm_command command;
+    while (segment_.pop(command))
+    {
+        if (command.op == detail::shm_command::detach)
+        {
+            detach(command.client);
+            continue;
+        }
+
+        // the slot is released or reused if the client is reaped.
+        auto& slot = segment_.slot(command.slot);
+        if (slot.owner.load() != command.client + 1 ||
+            slot.gen.load() != command.gen)
+        {
+            continue;
+        }
+
+        auto index = command.slot;
+        if (command.op == detail::shm_command::cancel)
+        {
+            // the last fire acks it already.
+            if (ids_[index] >= 0)
+            {
+                mgr_.cancel_timer(ids_[index]);
+                ids_[index] = -1;
+                pending_.fetch_sub(1);
+                segment_.push_fired(index, detail::shm_slot::done);
+            }
+
+            continue;
+        }
+
+        timer_spec spec;
+        spec.interval = std::chrono::microseconds(command.interval);
+        spec.repeat = command.repeat;
+        spec.catch_up = timer_catch_up::coalesce;
+
+        remaining_[index] = command.repeat;
+        ids_[index] = mgr_.create_timer(spec, [this, index](uint32_t missed)
+        {
+            fire(index, missed);
+        });
+
+        if (ids_[index] < 0)
+        {
+            segment_.push_fired(index, detail::shm_slot::done);
+            continue;
+        }
+
+        pending_.fetch_add(1);
+    }
+}
+
+inline void shm_timer_daemon::fire(uint32_t index, uint32_t missed)
+{
+    auto fired = missed + 1;
+    auto& remaining = remaining_[index];
+    if (remaining > 0)
+    {
+        remaining -= static_cast<int32_t>(
+            std::min<uint32_t>(fired, static_cast<uint32_t>(remaining)));
+        if (remaining == 0)
+        {
+            // the last fire, the timer is freed by the mgr.
+            fired |= detail::shm_slot::done;
+            ids_[index] = -1;
+            pending_.fetch_sub(1);
+        }
+    }
+
+    segment_.push_fired(index, fired);
+}
+
+inline void shm_timer_daemon::detach(uint32_t client)
+{
+    auto& header = segment_.header();
+    if (client >= header.max_clients)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < header.capacity; ++i)
+    {
+        auto& slot = segment_.slot(i);
+        if (slot.owner.load() != client + 1)
+        {
+            continue;
+        }
+
+        if (ids_[i] >= 0)
+        {
+            mgr_.cancel_timer(ids_[i]);
+            ids_[i] = -1;
+            pending_.fetch_sub(1);
+        }
+
+        segment_.free_slot(i);
+    }
+
+    auto& entry = segment_.client(client);
+    entry.fired_head.store(detail::shm_slot::end);
+    entry.waiting.store(0);
+    entry.pid.store(0);
+}
+
+inline void shm_timer_daemon::reap()
+{
+    // the timers of a crashed process are released.
+    auto& header = segment_.header();
+    for (uint32_t i = 0; i < header.max_clients; ++i)
+    {
+        auto pid = segment_.client(i).pid.load();
+        if (pid > 0 && ::kill(pid, 0) != 0 && errno == ESRCH)
+        {
+            detach(i);
+        }
+    }
+}
+
+// a process attached to a shm_timer_daemon, the callbacks run on the
+// dispatch thread of the process(or inside poll in manual_drive mode),
+// it has no schedule thread of its own.
+class shm_timer
+{
+public:
+    shm_timer(const shm_timer&) = delete;
+    shm_timer& operator=(const shm_timer&) = delete;
+
+    // the pending timers are canceled.
+    ~shm_timer();
+
+    // attach to the daemon of name, nullptr if it is not running or all
+    // clients are attached. manual_drive runs no threads, the application
+    // calls poll().
+    static std::unique_ptr<shm_timer> attach(const std::string& name,
+                                             bool manual_drive = false);
+
+    // the same as timer_iface, -1 if the table or the ring is full.
+    timer_id_t create_timer(int32_t msec, timer_callback cb);
+    timer_id_t create_timer(std::chrono::microseconds delay,
+                            timer_callback cb);
+    timer_id_t create_repeat_timer(std::chrono::microseconds interval,
+                                   int32_t repeat, timer_callback cb);
+    bool cancel_timer(timer_id_t timer_id);
+
+    // manual_drive mode: wait up to msec(-1 forever, 0 no wait) for the
+    // fired timers and run the callbacks, return the callbacks run.
+    size_t poll(int32_t msec);
+
+private:
+    // a local timer of a shared slot, the callback stays in the process.
+    struct entry
+    {
+        timer_id_t id{ -1 };
+        bool canceled{ false };
+        timer_callback cb;
+    };
+
+    shm_timer() = default;
+
+    bool push(const detail::shm_command& command, bool retry);
+    size_t dispatch();
+    void run();
+
+private:
+    // the cancel and detach commands retry a full ring.
+    static constexpr int push_retries = 10000;
+
+    detail::shm_segment segment_;
+    uint32_t client_{ 0 };
+    // a client slot is taken, it is detached on destruction.
+    bool attached_{ false };
+
+    std::mutex mtx_;
+    std::vector<entry> entries_;
+
+    std::atomic_bool stop_{ false };
+    std::thread dispatch_thd_;
+};
+
+inline shm_timer::~shm_timer()
+{
+    if (dispatch_thd_.joinable())
+    {
+        auto& client = segment_.client(client_);
+        stop_.store(true);
+        client.waiting.store(0);
+        detail::shm_futex_wake(&client.waiting);
+        dispatch_thd_.join();
+    }
+
+    if (!attached_)
+    {
+        return;
+    }
+
+    detail::shm_command command{};
+    command.op = detail::shm_command::detach;
+    command.client = client_;
+    push(command, true);
+}
+
+inline std::unique_ptr<shm_timer> shm_timer::attach(const std::string& name,
+                                                    bool manual_drive)
+{
+    std::unique_ptr<shm_timer> timer(new shm_timer());
+    if (!timer->segment_.open(name))
+    {
+        return nullptr;
+    }
+
+    auto& header = timer->segment_.header();
+    auto pid = static_cast<int32_t>(::getpid());
+    for (uint32_t i = 0; i < header.max_clients; ++i)
+    {
+        int32_t free_pid = 0;
+        auto& client = timer->segment_.client(i);
+        if (!client.pid.compare_exchange_strong(free_pid, pid))
+        {
+            continue;
+        }
+
+        client.waiting.store(0);
+        client.fired_head.store(detail::shm_slot::end);
+
+        timer->client_ = i;
+        timer->attached_ = true;
+        timer->entries_.resize(header.capacity);
+        if (!manual_drive)
+        {
+            timer->dispatch_thd_ = std::thread(&shm_timer::run, timer.get());
+        }
+
+        return timer;
+    }
+
+    return nullptr;
+}
+
+inline timer_id_t shm_timer::create_timer(int32_t msec, timer_callback cb)
+{
+    return create_timer(std::chrono::milliseconds(msec), std::move(cb));
+}
+
+inline timer_id_t shm_timer::create_timer(std::chrono::microseconds delay,
+                                          timer_callback cb)
+{
+    return create_repeat_timer(delay, 1, std::move(cb));
+}
+
+inline timer_id_t shm_timer::create_repeat_timer(
+    std::chrono::microseconds interval, int32_t repeat, timer_callback cb)
+{
+    if (interval.count() <= 0 && repeat != 1)
+    {
+        return -1; // a repeat timer needs a interval.
+    }
+
+    auto index = segment_.alloc_slot(client_);
+    if (index == detail::shm_slot::end)
+    {
+        return -1;
+    }
+
+    auto gen = segment_.slot(index).gen.load(std::memory_order_relaxed);
+    auto id = static_cast<timer_id_t>((uint64_t(gen) << 32) | index);
+    {
+        std::lock_guard<std::mutex> guard(mtx_);
+        auto& local = entries_[index];
+        local.id = id;
+        local.canceled = false;
+        local.cb = std::move(cb);
+    }
+
+    detail::shm_command command{};
+    command.op = detail::shm_command::create;
+    command.client = client_;
+    command.slot = index;
+    command.gen = gen;
+    command.interval = std::max<int64_t>(interval.count(), 0);
+    command.repeat = repeat > 0 ? repeat : timer_spec::forever;
+    if (!push(command, false))
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx_);
+            entries_[index] = entry();
+        }
+
+        segment_.free_slot(index);
+        return -1;
+    }
+
+    return id;
+}
+
+inline bool shm_timer::cancel_timer(timer_id_t timer_id)
+{
+    if (timer_id < 0)
+    {
+        return false;
+    }
+
+    auto index = static_cast<uint32_t>(timer_id);
+    if (index >= entries_.size())
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mtx_);
+        auto& local = entries_[index];
+        if (local.id != timer_id || local.canceled)
+        {
+            return false;
+        }
+
+        // never run again, the slot is released when the daemon acks.
+        local.canceled = true;
+        local.cb = nullptr;
+    }
+
+    detail::shm_command command{};
+    command.op = detail::shm_command::cancel;
+    command.client = client_;
+    command.slot = index;
+    command.gen = static_cast<uint32_t>(timer_id >> 32);
+    push(command, true);
+    return true;
+}
+
+inline bool shm_timer::push(const detail::shm_command& command, bool retry)
+{
+    auto& header = segment_.header();
+    for (int i = 0; !segment_.push(command); ++i)
+    {
+        if (!retry || i == push_retries)
+        {
+            return false;
+        }
+
+        std::this_thread::yield();
+    }
+
+    if (header.waiting.exchange(0) != 0)
+    {
+        detail::shm_futex_wake(&header.waiting);
+    }
+
+    return true;
+}
+
+inline size_t shm_timer::poll(int32_t msec)
+{
+    auto& client = segment_.client(client_);
+    if (msec != 0 &&
+        client.fired_head.load() == detail::shm_slot::end)
+    {
+        // the daemon wakes the client if it sees waiting.
+        client.waiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (client.fired_head.load() == detail::shm_slot::end &&
+            !stop_.load())
+        {
+            detail::shm_futex_wait(&client.waiting, 1, msec);
+        }
+
+        client.waiting.store(0);
+    }
+
+    return dispatch();
+}
+
+inline size_t shm_timer::dispatch()
+{
+    auto& client = segment_.client(client_);
+    auto head = client.fired_head.exchange(detail::shm_slot::end);
+
+    // reverse to the fired order, the daemon never links a slot again
+    // before its fires are taken below.
+    auto prev = detail::shm_slot::end;
+    while (head != detail::shm_slot::end)
+    {
+        auto& slot = segment_.slot(head);
+        auto next = slot.next.load(std::memory_order_relaxed);
+        slot.next.store(prev, std::memory_order_relaxed);
+        prev = head;
+        head = next;
+    }
+
+    size_t count = 0;
+    for (auto index = prev; index != detail::shm_slot::end;)
+    {
+        auto& slot = segment_.slot(index);
+        auto next = slot.next.load(std::memory_order_relaxed);
+        auto fired = slot.fired.exchange(0);
+        auto done = (fired & detail::shm_slot::done) != 0;
+        fired &= ~detail::shm_slot::done;
+
+        timer_callback cb;
+        auto& local = entries_[index];
+        {
+            std::lock_guard<std::mutex> guard(mtx_);
+            if (!local.canceled)
+            {
+                cb = std::move(local.cb);
+            }
+        }
+
+        if (cb && fired > 0)
+        {
+            cb(fired - 1);
+            ++count;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(mtx_);
+            if (done)
+            {
+                local = entry();
+            }
+            else if (!local.canceled)
+            {
+                local.cb = std::move(cb);
+            }
+        }
+
+        // the slot is reused by any process after it is freed.
+        if (done)
+        {
+            segment_.free_slot(index);
+        }
+
+        index = next;
+    }
+
+    return count;
+}
+
+inline void shm_timer::run()
+{
+    detail::apply_thread_options(timer_thread_options(), "timer-shm-event");
+    while (!stop_.load())
+    {
+        poll(-1);
+    }
+}
+
+} // namespace timer
+} // namespace utility
+
+#endif // __UTILITY_TIMER_SHM_H__
@@ -31,12 +31,34 @@ THE SOFTWARE.
 #include <cstdint>
 #include <mutex>
 #include <map>
-#include <list>
-#include <unordered_map>
+#include <deque>
+#include <vector>
 #include <atomic>
 #include <cassert>
 #include <memory>
 #include <condition_variable>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
 
 namespace utility
 {
@@ -46,356 +68,4506 @@ namespace timer
 // the timer callback function signature.
 using timer_event_t = std::function<void()>;
 
+// the timer id, a negative id is invalid.
+using timer_id_t = int64_t;
+
+// move-only timer callback, a callable fits the inline buffer is stored
+// without allocation, a larger one is stored on heap.
+// the timer_event_t and lambda are implicitly converted to it.
+class timer_callback
+{
+public:
+    static constexpr size_t inline_size = 48;
+
+    timer_callback() noexcept = default;
+    timer_callback(std::nullptr_t) noexcept {}
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type,
+                      timer_callback>::value>::type>
+    timer_callback(F&& f)
+    {
+        using type = typename std::decay<F>::type;
+        construct<type>(std::forward<F>(f), is_inline<type>());
+    }
+
+    timer_callback(const timer_callback&) = delete;
+    timer_callback& operator=(const timer_callback&) = delete;
+
+    timer_callback(timer_callback&& other) noexcept
+    {
+        move_from(other);
+    }
+
+    timer_callback& operator=(timer_callback&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            move_from(other);
+        }
+
+        return *this;
+    }
+
+    timer_callback& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    ~timer_callback() { reset(); }
+
+    explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+    // a callable of void(uint32_t missed) gets the missed ticks of a
+    // repeat timer(see timer_catch_up), a void() one ignores it.
+    void operator()() { invoke_(&buffer_, 0); }
+    void operator()(uint32_t missed) { invoke_(&buffer_, missed); }
+
+private:
+    template <typename T>
+    using is_inline = std::integral_constant<bool,
+        sizeof(T) <= inline_size &&
+        alignof(T) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<T>::value>;
+
+    // move src to dst if dst is not null, otherwise destroy src.
+    using invoke_fn = void (*)(void*, uint32_t missed);
+    using manage_fn = void (*)(void* dst, void* src);
+
+    template <typename T>
+    static auto call(T& f, uint32_t missed, int) -> decltype(f(missed), void())
+    {
+        f(missed);
+    }
+
+    template <typename T>
+    static void call(T& f, uint32_t, long)
+    {
+        f();
+    }
+
+    template <typename T, typename F>
+    void construct(F&& f, std::true_type)
+    {
+        ::new (static_cast<void*>(&buffer_)) T(std::forward<F>(f));
+        invoke_ = [](void* self, uint32_t missed)
+        {
+            call(*static_cast<T*>(self), missed, 0);
+        };
+        manage_ = [](void* dst, void* src)
+        {
+            auto obj = static_cast<T*>(src);
+            if (dst != nullptr)
+            {
+                ::new (dst) T(std::move(*obj));
+            }
+            obj->~T();
+        };
+    }
+
+    template <typename T, typename F>
+    void construct(F&& f, std::false_type)
+    {
+        ::new (static_cast<void*>(&buffer_)) T*(new T(std::forward<F>(f)));
+        invoke_ = [](void* self, uint32_t missed)
+        {
+            call(**static_cast<T**>(self), missed, 0);
+        };
+        manage_ = [](void* dst, void* src)
+        {
+            auto obj = static_cast<T**>(src);
+            if (dst != nullptr)
+            {
+                ::new (dst) T*(*obj);
+                return;
+            }
+            delete *obj;
+        };
+    }
+
+    void move_from(timer_callback& other) noexcept
+    {
+        if (other.invoke_ != nullptr)
+        {
+            other.manage_(&buffer_, &other.buffer_);
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            other.invoke_ = nullptr;
+            other.manage_ = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (invoke_ != nullptr)
+        {
+            manage_(nullptr, &buffer_);
+            invoke_ = nullptr;
+            manage_ = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char buffer_[inline_size];
+    invoke_fn invoke_{ nullptr };
+    manage_fn manage_{ nullptr };
+};
+
+namespace detail
+{
+class histogram_recorder;
+}
+
+// log-bucketed histogram(HDR style) of microseconds, 16 linear buckets
+// for every power of 2, so the relative error is within 1/16.
+// the values over 2^32us(about 71 minutes) are in the last bucket.
+class timer_histogram
+{
+public:
+    static constexpr int sub_bits = 4;
+    static constexpr int sub_count = 1 << sub_bits;
+    static constexpr int max_bits = 32;
+    static constexpr int buckets = (max_bits - sub_bits + 1) * sub_count;
+
+    static int bucket_of(uint64_t value)
+    {
+        if (value < sub_count)
+        {
+            return static_cast<int>(value);
+        }
+
+        auto msb = highest_bit(value);
+        if (msb >= max_bits)
+        {
+            return buckets - 1;
+        }
+
+        auto sub = static_cast<int>(
+            (value >> (msb - sub_bits)) & (sub_count - 1));
+        return (msb - sub_bits + 1) * sub_count + sub;
+    }
+
+    // the smallest value of a bucket.
+    static uint64_t lower_of(int bucket)
+    {
+        if (bucket < 2 * sub_count)
+        {
+            return static_cast<uint64_t>(bucket);
+        }
+
+        auto msb = bucket / sub_count + sub_bits - 1;
+        auto sub = static_cast<uint64_t>(bucket % sub_count);
+        return (sub_count + sub) << (msb - sub_bits);
+    }
+
+    void record(uint64_t value)
+    {
+        ++counts_[bucket_of(value)];
+        ++count_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const timer_histogram& other)
+    {
+        for (int i = 0; i < buckets; ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    uint64_t mean() const { return count_ == 0 ? 0 : sum_ / count_; }
+
+    // the value at percent(e.g. 99.9) of the recorded values,
+    // the highest value of its bucket.
+    uint64_t percentile(double percent) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+
+        auto rank = static_cast<uint64_t>(percent / 100.0 * count_ + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+
+        uint64_t seen = 0;
+        for (int i = 0; i < buckets; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+            {
+                auto upper = i + 1 < buckets ? lower_of(i + 1) - 1 : max_;
+                return std::min(upper, max_);
+            }
+        }
+
+        return max_;
+    }
+
+private:
+    friend class detail::histogram_recorder;
+
+    static int highest_bit(uint64_t value)
+    {
+        int bit = 0;
+        for (int step = 32; step > 0; step /= 2)
+        {
+            if (value >> step)
+            {
+                value >>= step;
+                bit += step;
+            }
+        }
+
+        return bit;
+    }
+
+private:
+    uint64_t counts_[buckets]{};
+    uint64_t count_{ 0 };
+    uint64_t sum_{ 0 };
+    uint64_t max_{ 0 };
+};
+
+// timer runtime statistics.
+struct timer_stats
+{
+    // times the schedule thread woke up.
+    uint64_t wakeups{ 0 };
+
+    // the batches of expired callbacks handed to the executor,
+    // the total callbacks in them and the largest one.
+    uint64_t batches{ 0 };
+    uint64_t batched_events{ 0 };
+    uint64_t max_batch{ 0 };
+
+    // the timer objects allocated by the pool, the canceled timers are
+    // unlinked at once, so it is bounded by the live timers.
+    uint64_t pool_capacity{ 0 };
+
+    // the callbacks due but not started in the executor, and the ones
+    // dropped or run on the schedule thread by timer_options::overload.
+    uint64_t queued_callbacks{ 0 };
+    uint64_t dropped_callbacks{ 0 };
+    uint64_t inline_callbacks{ 0 };
+
+    // the latency instrumentation, define UTILITY_TIMER_NO_STATS to
+    // turn it off, all in microseconds.
+#ifndef UTILITY_TIMER_NO_STATS
+    // the microseconds since the timer is created, e.g. the wakeups rate.
+    uint64_t elapsed_usec{ 0 };
+    // the timers in the scheduler queue.
+    uint64_t pending_timers{ 0 };
+
+    // the lag from the deadline to the hand-off to executor.
+    timer_histogram lateness;
+    // the delay in the executor queue before the callback runs.
+    timer_histogram queue_delay;
+    // the execution time of callbacks.
+    timer_histogram run_time;
+#endif
+};
+
+// the dispatch lane of a timer's callbacks(timer_spec::lane): a higher
+// lane is handed to the executor first and runs before the lower ones
+// queued, so a latency-critical timer never waits behind bulk work.
+enum class timer_lane : uint8_t
+{
+    high,
+    normal,
+    background,
+};
+
+constexpr size_t timer_lanes = 3;
+
+// a expired timer posted to the timer_executor, it must be run exactly
+// once, and before the timer manager is destroyed.
+class timer_task
+{
+public:
+    using run_fn = void (*)(void* owner, void* timer, int64_t posted);
+
+    timer_task() noexcept = default;
+    timer_task(run_fn run, void* owner, void* timer,
+               int64_t posted = 0) noexcept
+        : run_(run), owner_(owner), timer_(timer), posted_(posted) {}
+
+    void operator()() const { run_(owner_, timer_, posted_); }
+
+private:
+    run_fn  run_{ nullptr };
+    void*   owner_{ nullptr };
+    void*   timer_{ nullptr };
+    // the tick posted to executor, for timer_stats::queue_delay.
+    int64_t posted_{ 0 };
+};
+
+// the points of a timer passed to timer_trace_sink.
+enum class timer_trace_point : uint8_t
+{
+    // the timer is created.
+    create,
+    // a tick expired and its callback is handed to the executor.
+    fire,
+    // the callback starts and returns on the executor thread.
+    dispatch_start,
+    dispatch_end,
+};
+
+// a trace event, the times are microseconds of the timer clock, a paused
+// time doesn't count.
+struct timer_trace_event
+{
+    timer_trace_point point{ timer_trace_point::create };
+    timer_lane lane{ timer_lane::normal };
+    // the id of the shard in a sharded_timer.
+    timer_id_t timer_id{ -1 };
+    // timer_spec::label, nullptr if not labeled.
+    const char* label{ nullptr };
+    int64_t time{ 0 };
+    // the deadline of the next tick(create) or the tick fired(fire),
+    // 0 for the dispatch events.
+    int64_t deadline{ 0 };
+};
+
+// the receiver of trace events, e.g. a adapter to Perfetto or LTTng.
+// the creating, schedule and executor threads call it concurrently, it
+// must be thread-safe and fast.
+class timer_trace_sink
+{
+public:
+    virtual ~timer_trace_sink() = default;
+
+    virtual void record(const timer_trace_event& event) = 0;
+};
+
+// the callbacks due but not run yet on shutdown():
+enum class timer_drain
+{
+    // run them until the deadline, drop the rest.
+    run,
+    // drop them at once, the running callbacks are finished.
+    discard,
+};
+
+// the executor runs the expired timer callbacks, e.g. a thread pool or
+// a event loop of the application.
+class timer_executor
+{
+public:
+    virtual ~timer_executor() = default;
+
+    // post a batch of tasks, called by the schedule thread.
+    virtual void post(const timer_task* tasks, size_t count) = 0;
+    // post a batch of a lane, the lanes of a fire are posted high first.
+    // a executor without lanes runs them in the posted order.
+    virtual void post(timer_lane lane, const timer_task* tasks, size_t count)
+    {
+        (void)lane;
+        post(tasks, count);
+    }
+
+    // stop the threads of executor, return the tasks dropped.
+    // an application executor keeps its own tasks by default.
+    virtual size_t shutdown(timer_drain drain,
+                            std::chrono::steady_clock::time_point deadline)
+    {
+        (void)drain;
+        (void)deadline;
+        return 0;
+    }
+};
+
+// the schedule thread sleeps on:
+enum class timer_backend
+{
+    // std::condition_variable, portable.
+    condition_variable,
+    // timerfd on Linux, high resolution waitable timer on Windows,
+    // condition_variable on the other platforms.
+    native,
+};
+
+// the missed ticks of a repeat timer after a stall(e.g. a GC pause),
+// the ticks stay aligned to the first deadline for every policy.
+enum class timer_catch_up
+{
+    // run every missed tick back-to-back.
+    fire_all,
+    // run once with the count of missed ticks, they count for the repeat.
+    coalesce,
+    // run once and drop the missed ticks, they don't count for the repeat,
+    // the callback still gets the count.
+    skip,
+};
+
+// the parameters of a timer.
+struct timer_spec
+{
+    // repeat until canceled.
+    static constexpr int32_t forever = -1;
+
+    // the delay of the first fire and the interval of repeats, a repeat
+    // timer needs a positive one, or it is not created.
+    std::chrono::microseconds interval{ 0 };
+    // fire times, 1 is a once timer, forever(or 0) never stops.
+    int32_t repeat{ 1 };
+    timer_catch_up catch_up{ timer_catch_up::fire_all };
+    // the timer may fire up to slack late, so the scheduler coalesces
+    // the timers of close deadlines into one wakeup and one batch.
+    std::chrono::microseconds slack{ 0 };
+    timer_lane lane{ timer_lane::normal };
+    // the name in the trace events, a static string(not copied).
+    const char* label{ nullptr };
+};
+
+// the thread options of the schedule thread and the executor threads,
+// applied by the thread itself on start, best effort(e.g. a real-time
+// priority needs CAP_SYS_NICE on Linux).
+struct timer_thread_options
+{
+    // the thread name, empty is the default one(e.g. timer-schedule),
+    // Linux truncates it to 15 characters.
+    std::string name;
+    // pin the thread to these cpus, empty keeps the inherited affinity.
+    std::vector<int> cpus;
+    // > 0 is SCHED_FIFO of the priority(1-99) on Linux and
+    // THREAD_PRIORITY_TIME_CRITICAL on Windows, 0 keeps the default.
+    int32_t priority{ 0 };
+};
+
+// the executor queue is full(timer_options::max_queued_callbacks):
+enum class timer_overload
+{
+    // the schedule thread waits for room, the later timers fire late. the
+    // callbacks collected before the wait are posted first, ahead of the
+    // higher lanes expired later in the pass.
+    block,
+    // drop the new callbacks.
+    drop_newest,
+    // run the new callbacks on the schedule thread, the one of a ordered
+    // timer with callbacks queued is dropped to keep the order.
+    run_inline,
+};
+
+// timer manager construction options.
+struct timer_options
+{
+    // create_timer pushes the timer into a lock-free queue drained by the
+    // schedule thread, so the callers never block on the scheduler.
+    bool async_submit{ false };
+
+    // the executor of callbacks(not owned), it must outlive the timer.
+    // nullptr uses a dedicated event thread or the pool below.
+    timer_executor* executor{ nullptr };
+    // callbacks run on a pool of threads with work-stealing deques,
+    // 1 is the dedicated event thread.
+    int32_t executor_threads{ 1 };
+    // a timer's callbacks run one by one in order and never overlap,
+    // different timers still run in parallel.
+    bool ordered_callbacks{ true };
+    // the bound of callbacks due but not started in the executor, 0 is
+    // unbounded, the overload policy applies when it is full.
+    size_t max_queued_callbacks{ 0 };
+    timer_overload overload{ timer_overload::block };
+    // timer_lane::high and background get a dedicated event thread each
+    // (timer-high and timer-background), otherwise they share the
+    // executor of the normal lane.
+    bool lane_threads{ false };
+
+    // the sink of trace events(not owned), it must outlive the timer.
+    // the hooks are compiled in only if UTILITY_TIMER_TRACE is defined,
+    // otherwise it is ignored.
+    timer_trace_sink* trace_sink{ nullptr };
+
+    // no threads of its own, the application calls next_timeout() and
+    // advance() from its event loop, the callbacks run inline on the
+    // calling thread unless a executor is given.
+    bool manual_drive{ false };
+
+    // high resolution mode: the schedule thread spins the last spin_usec
+    // microseconds before the deadline instead of sleeping, it burns a
+    // core for the wake up latency of the condition_variable. 0 disables.
+    int32_t spin_usec{ 0 };
+
+    // the waiter of the schedule thread.
+    timer_backend backend{ timer_backend::condition_variable };
+
+    // the name, cpu affinity and priority of the threads, the executor
+    // options apply to every thread of the pool.
+    timer_thread_options schedule_thread;
+    timer_thread_options executor_thread;
+};
+
+// the callbacks of persistent timers by key: a saved timer keeps the key
+// and the data of its callback, restore_timers makes the callback again.
+class timer_registry
+{
+public:
+    using factory_t = std::function<timer_callback(const std::string& data)>;
+
+    // false if the key is registered already.
+    bool add(const std::string& key, factory_t factory)
+    {
+        return factories_.emplace(key, std::move(factory)).second;
+    }
+
+    // a empty callback if the key is not registered.
+    timer_callback make(const std::string& key,
+                        const std::string& data) const
+    {
+        auto it = factories_.find(key);
+        return it == factories_.end() ? timer_callback() : it->second(data);
+    }
+
+private:
+    std::map<std::string, factory_t> factories_;
+};
+
 // timer interface defination.
 class timer_iface
 {
 public:
     virtual ~timer_iface() = default;
 
-    // create a once timer delay msec.
-    virtual int32_t create_timer(int32_t msec, timer_event_t cb) = 0;
-    // create a repeat timer delay msec.
-    virtual int32_t create_repeat_timer(int32_t msec, int32_t repeat,
-                                        timer_event_t cb) = 0;
-    // cancel a timer with id.
-    virtual bool cancel_timer(int32_t timer_id) = 0;
+    // create a once timer delay msec.
+    virtual timer_id_t create_timer(int32_t msec, timer_callback cb) = 0;
+    // create a repeat timer delay msec, repeat forever if repeat <= 0,
+    // -1 if msec <= 0(a busy loop) unless repeat is 1.
+    virtual timer_id_t create_repeat_timer(int32_t msec, int32_t repeat,
+                                           timer_callback cb) = 0;
+
+    // microsecond resolution timers, any std::chrono::duration
+    // converted to microseconds without loss can be passed.
+    virtual timer_id_t create_timer(std::chrono::microseconds delay,
+                                    timer_callback cb) = 0;
+    virtual timer_id_t create_repeat_timer(std::chrono::microseconds interval,
+                                           int32_t repeat,
+                                           timer_callback cb) = 0;
+    // create a timer of all parameters.
+    virtual timer_id_t create_timer(const timer_spec& spec,
+                                    timer_callback cb) = 0;
+
+    // create a labeled timer, the label is a static string named in the
+    // trace events(timer_spec::label).
+    timer_id_t create_timer(int32_t msec, timer_callback cb,
+                            const char* label)
+    {
+        return create_timer(std::chrono::milliseconds(msec), std::move(cb),
+                            label);
+    }
+    timer_id_t create_repeat_timer(int32_t msec, int32_t repeat,
+                                   timer_callback cb, const char* label)
+    {
+        return create_repeat_timer(std::chrono::milliseconds(msec), repeat,
+                                   std::move(cb), label);
+    }
+    timer_id_t create_timer(std::chrono::microseconds delay,
+                            timer_callback cb, const char* label)
+    {
+        return create_repeat_timer(delay, 1, std::move(cb), label);
+    }
+    timer_id_t create_repeat_timer(std::chrono::microseconds interval,
+                                   int32_t repeat, timer_callback cb,
+                                   const char* label)
+    {
+        timer_spec spec;
+        spec.interval = interval;
+        spec.repeat = repeat;
+        spec.label = label;
+        return create_timer(spec, std::move(cb));
+    }
+
+    // create a cohort of timers at once, the callbacks are moved,
+    // ids[i] is -1 if the timer of specs[i] is not created.
+    // return the count of timers created.
+    virtual size_t create_timers(const timer_spec* specs, timer_callback* cbs,
+                                 size_t count, timer_id_t* ids) = 0;
+    // cancel a timer with id.
+    virtual bool cancel_timer(timer_id_t timer_id) = 0;
+    // cancel a batch of timers, return the count of timers canceled.
+    virtual size_t cancel_timers(const timer_id_t* ids, size_t count) = 0;
+
+    // move the next fire of a timer to msec later from now, or postpone
+    // it by msec, keep the id and callback. a later deadline is applied
+    // lazily when the old one comes. false if canceled or freed, or the
+    // last fire is done(e.g. from the callback of a once timer), a new
+    // timer is needed then.
+    virtual bool reset_timer(timer_id_t timer_id, int32_t msec) = 0;
+    virtual bool reset_timer(timer_id_t timer_id,
+                             std::chrono::microseconds delay) = 0;
+    virtual bool postpone_timer(timer_id_t timer_id, int32_t msec) = 0;
+    virtual bool postpone_timer(timer_id_t timer_id,
+                                std::chrono::microseconds delta) = 0;
+
+    // get the runtime statistics.
+    virtual timer_stats stats() const = 0;
+
+    // stop the timer at once: the threads are woken up, the timers due by
+    // now and the callbacks queued are run until deadline or dropped, the
+    // timers not due are never fired. create_timer fails afterwards.
+    // return the callbacks dropped.
+    virtual size_t shutdown(
+        timer_drain drain = timer_drain::discard,
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max()) = 0;
+
+    // singleton interface.
+    static timer_iface& get();
+
+    // create a timer instance of its own threads, nullptr if
+    // options.manual_drive(a timer_mgr is driven by next_timeout() and
+    // advance() instead).
+    static std::unique_ptr<timer_iface> create(
+        const timer_options& options = timer_options());
+};
+
+////////////////////////////////////////////////////////////////////////
+
+
+// timer_iface implement.
+namespace detail
+{
+
+#ifndef UTILITY_TIMER_NO_STATS
+// the lock-free recorder of timer_histogram, concurrent writers
+// are spread over stripes to not contend on a counter.
+class histogram_recorder
+{
+public:
+    static constexpr size_t stripes = 4;
+
+    void record(uint64_t value)
+    {
+        auto& stripe = stripes_[thread_stripe()];
+        stripe.counts[timer_histogram::bucket_of(value)].fetch_add(
+            1, std::memory_order_relaxed);
+        stripe.sum.fetch_add(value, std::memory_order_relaxed);
+
+        auto max = stripe.max.load(std::memory_order_relaxed);
+        while (value > max &&
+               !stripe.max.compare_exchange_weak(max, value,
+                                                 std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void snapshot(timer_histogram& result) const
+    {
+        for (auto& stripe : stripes_)
+        {
+            for (int i = 0; i < timer_histogram::buckets; ++i)
+            {
+                auto count = stripe.counts[i].load(std::memory_order_relaxed);
+                result.counts_[i] += count;
+                result.count_ += count;
+            }
+
+            result.sum_ += stripe.sum.load(std::memory_order_relaxed);
+            result.max_ = std::max(
+                result.max_, stripe.max.load(std::memory_order_relaxed));
+        }
+    }
+
+private:
+    static size_t thread_stripe()
+    {
+        static std::atomic<size_t> next{ 0 };
+        static thread_local size_t stripe = next.fetch_add(1) % stripes;
+        return stripe;
+    }
+
+    struct stripe_t
+    {
+        std::atomic<uint64_t> counts[timer_histogram::buckets]{};
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> max{ 0 };
+    };
+
+    stripe_t stripes_[stripes];
+};
+#endif
+
+// intrusive multi-producer/single-consumer queue(Dmitry Vyukov's),
+// push is wait-free, pop is only called by the consumer thread.
+struct mpsc_node
+{
+    std::atomic<mpsc_node*> mpsc_next{ nullptr };
+};
+
+class mpsc_queue
+{
+public:
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    mpsc_queue() noexcept : head_(&stub_), tail_(&stub_) {}
+
+    void push(mpsc_node* node) { push(node, node); }
+
+    // push a chain of nodes linked by mpsc_next with one exchange.
+    void push(mpsc_node* first, mpsc_node* last)
+    {
+        last->mpsc_next.store(nullptr, std::memory_order_relaxed);
+        auto prev = head_.exchange(last, std::memory_order_seq_cst);
+        prev->mpsc_next.store(first, std::memory_order_release);
+    }
+
+    // return nullptr if the queue is empty or a push is in progress.
+    mpsc_node* pop();
+
+    // called by the consumer, a push in progress is not empty.
+    bool empty() const
+    {
+        return tail_ == &stub_ &&
+            head_.load(std::memory_order_seq_cst) == &stub_;
+    }
+
+private:
+    std::atomic<mpsc_node*> head_;
+    mpsc_node* tail_;
+    mpsc_node stub_;
+};
+
+inline mpsc_node* mpsc_queue::pop()
+{
+    auto tail = tail_;
+    auto next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (tail == &stub_)
+    {
+        if (next == nullptr)
+        {
+            return nullptr;
+        }
+
+        tail_ = next;
+        tail = next;
+        next = next->mpsc_next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    if (tail != head_.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+
+    // tail is the last node, push the stub to pop it.
+    push(&stub_);
+    next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (next != nullptr)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+// the intrusive link of the timer bucket.
+struct timer_link
+{
+    timer_link* prev{ this };
+    timer_link* next{ this };
+};
+
+struct timer_t;
+
+// the callback key of a persistent timer.
+struct timer_persist
+{
+    std::string key;
+    std::string data;
+};
+
+// the file of save_timers: the header and the records, every record is
+// followed by the key and the data. the structs are copied as they are,
+// the layout is pinned below and a file of the other byte order is
+// rejected by restore_timers.
+struct persist_header
+{
+    static constexpr uint32_t magic_value = 0x53545843;
+    static constexpr uint32_t version_value = 3;
+    // reads 0x04030201 on a host of the other byte order.
+    static constexpr uint32_t byte_order_value = 0x01020304;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct persist_record
+{
+    timer_id_t timer_id;
+    // microseconds since the epoch of system_clock.
+    int64_t    deadline;
+    int64_t    interval;
+    int64_t    slack;
+    int32_t    repeat;
+    uint16_t   catch_up;
+    uint16_t   lane;
+    uint32_t   key_size;
+    uint32_t   data_size;
+};
+
+static_assert(std::is_trivially_copyable<persist_header>::value &&
+              std::is_trivially_copyable<persist_record>::value,
+              "the persist structs are copied by memcpy");
+static_assert(sizeof(persist_header) == 24 &&
+              offsetof(persist_header, byte_order) == 8 &&
+              offsetof(persist_header, count) == 16,
+              "the persist header layout is fixed");
+static_assert(sizeof(persist_record) == 48 &&
+              offsetof(persist_record, deadline) == 8 &&
+              offsetof(persist_record, interval) == 16 &&
+              offsetof(persist_record, slack) == 24 &&
+              offsetof(persist_record, repeat) == 32 &&
+              offsetof(persist_record, catch_up) == 36 &&
+              offsetof(persist_record, lane) == 38 &&
+              offsetof(persist_record, key_size) == 40 &&
+              offsetof(persist_record, data_size) == 44,
+              "the persist record layout is fixed");
+
+// microseconds since the epoch, the deadlines saved survive a restart.
+inline int64_t wall_now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        system_clock::now().time_since_epoch()).count();
+}
+
+// write into path.tmp and rename it, a crash never leaves a torn file.
+inline bool write_file(const std::string& path, const std::string& content)
+{
+    auto tmp = path + ".tmp";
+    auto file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    auto ok = std::fwrite(content.data(), 1, content.size(), file) ==
+        content.size() && std::fflush(file) == 0;
+#if defined(__linux__)
+    ok = ok && ::fsync(::fileno(file)) == 0;
+#endif
+    ok = std::fclose(file) == 0 && ok;
+
+#if defined(_WIN32)
+    ok = ok && ::MoveFileExA(tmp.c_str(), path.c_str(),
+                             MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok)
+    {
+        std::remove(tmp.c_str());
+    }
+
+    return ok;
+}
+
+inline bool read_file(const std::string& path, std::string& content)
+{
+    auto file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t size = 0;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        content.append(buffer, size);
+    }
+
+    auto ok = std::ferror(file) == 0;
+    std::fclose(file);
+    return ok;
+}
+
+// async_submit mode: a command of timer pushed to the schedule thread.
+struct timer_cmd : mpsc_node
+{
+    timer_t* timer{ nullptr };
+};
+
+struct timer_t : timer_link
+{
+    timer_t() noexcept
+    {
+        submit_cmd.timer = this;
+        cancel_cmd.timer = this;
+        reset_cmd.timer = this;
+    }
+
+    // the scheduler ticks are microseconds.
+    int64_t        interval{ 0 };
+    int64_t        slack{ 0 };
+    // the deadline once the last fire is done, reset_timer fails then.
+    static constexpr int64_t finished = std::numeric_limits<int64_t>::min();
+
+    // the nominal expired time(reset_timer changes it at any time)
+    // and the coalesced one in queue.
+    std::atomic<int64_t> deadline{ 0 };
+    int64_t        expires{ 0 };
+    timer_id_t     timer_id{ 0 };
+    // the fires left, timer_spec::forever never stops, read by
+    // save_timers at any time.
+    std::atomic<int32_t> repeat{ 0 };
+    timer_catch_up catch_up{ timer_catch_up::fire_all };
+    timer_lane     lane{ timer_lane::normal };
+    // timer_spec::label.
+    const char*    label{ nullptr };
+    timer_callback timer_cb{ nullptr };
+    // the missed ticks passed to the next callback.
+    std::atomic<uint32_t> missed{ 0 };
+    // the callback key of a persistent timer, nullptr if not persistent.
+    std::unique_ptr<timer_persist> persist;
+
+    // the schedule thread owns one reference while the timer is scheduled,
+    // every queued callback event owns one, the last one frees the timer.
+    std::atomic<uint32_t> refs{ 0 };
+    // ordered_callbacks: the callback events not run yet, the timer is
+    // posted to the executor once and runs them all.
+    std::atomic<uint32_t> pending{ 0 };
+
+    // the index of timer_pool and the link of free list(index + 1).
+    uint32_t              slot{ 0 };
+    // the position in heap_queue, for erase in O(log n).
+    uint32_t              heap_index{ 0 };
+    std::atomic<uint32_t> free_next{ 0 };
+    // generation << 2 | state, cancel_timer CAS it without lock.
+    std::atomic<uint32_t> tag{ 0 };
+
+    // the timer is linked in the scheduler queue, not expired or
+    // being processed, guarded by schedule_mtx_.
+    bool queued{ false };
+    // every command is pushed once a generation.
+    timer_cmd submit_cmd;
+    timer_cmd cancel_cmd;
+    // reset_timer to a earlier deadline, pushed once until drained.
+    timer_cmd reset_cmd;
+    std::atomic_bool reset_pending{ false };
+
+    enum state : uint32_t
+    {
+        state_free = 0,
+        state_active = 1,
+        state_canceled = 2,
+    };
+
+    bool canceled() const
+    {
+        return (tag.load(std::memory_order_acquire) & 3U) == state_canceled;
+    }
+};
+
+// the timer bucket expired on same time, an intrusive circular list,
+// link and unlink a timer never allocate.
+class timer_bucket
+{
+public:
+    timer_bucket(const timer_bucket&) = delete;
+    timer_bucket& operator=(const timer_bucket&) = delete;
+
+    timer_bucket() = default;
+
+    bool empty() const { return head_.next == &head_; }
+
+    timer_t* front() const
+    {
+        return empty() ? nullptr : static_cast<timer_t*>(head_.next);
+    }
+
+    timer_t* next(const timer_t* timer) const
+    {
+        return timer->next == &head_ ? nullptr
+                                     : static_cast<timer_t*>(timer->next);
+    }
+
+    void push_back(timer_t* timer)
+    {
+        timer->prev = head_.prev;
+        timer->next = &head_;
+        head_.prev->next = timer;
+        head_.prev = timer;
+    }
+
+    timer_t* pop_front()
+    {
+        auto timer = front();
+        if (timer != nullptr)
+        {
+            unlink(timer);
+        }
+
+        return timer;
+    }
+
+    // append all timers of other, other becomes empty.
+    void splice(timer_bucket& other)
+    {
+        if (other.empty())
+        {
+            return;
+        }
+
+        other.head_.next->prev = head_.prev;
+        other.head_.prev->next = &head_;
+        head_.prev->next = other.head_.next;
+        head_.prev = other.head_.prev;
+        other.head_.prev = other.head_.next = &other.head_;
+    }
+
+    static void unlink(timer_t* timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = timer;
+    }
+
+    // unlink a queued timer, return its bucket if it becomes empty.
+    static timer_bucket* remove(timer_t* timer)
+    {
+        // the only timer links to the head of bucket on both sides.
+        auto head = timer->prev == timer->next ? timer->next : nullptr;
+        unlink(timer);
+        return reinterpret_cast<timer_bucket*>(head);
+    }
+
+private:
+    timer_link head_;
+};
+
+static_assert(std::is_standard_layout<timer_bucket>::value,
+              "the head link is the address of bucket");
+
+// the expired timer buckets managed by key：expired time
+using expired_timer_buckets = std::map<int64_t, timer_bucket>;
+
+// slab allocator of timers, chunks are never freed until destruction,
+// so a free list(Treiber stack) and cancel_timer can read a slot lock-free.
+//
+// the timer id is generation << slot_bits | slot, the generation is
+// increased on free, so a stale id never matches a reused slot.
+class timer_pool
+{
+public:
+    static constexpr int slot_bits = 23;
+    static constexpr int gen_bits = 30;
+    static constexpr uint32_t gen_mask = (1U << gen_bits) - 1;
+
+    timer_pool(const timer_pool&) = delete;
+    timer_pool& operator=(const timer_pool&) = delete;
+
+    timer_pool() noexcept
+    {
+        for (auto& chunk : chunks_)
+        {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~timer_pool() noexcept
+    {
+        for (auto& chunk : chunks_)
+        {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    // return nullptr if the pool is exhausted.
+    timer_t* alloc();
+    void free(timer_t* timer);
+
+    // find the active timer by id, return nullptr if not found.
+    timer_t* find(timer_id_t timer_id) const;
+    // the id of the active timer in slot, -1 if none.
+    timer_id_t active_id(uint32_t slot) const;
+
+    // timers alloced from the system allocator.
+    size_t capacity() const
+    {
+        return chunk_count_.load(std::memory_order_acquire) * chunk_size;
+    }
+
+private:
+    static constexpr int chunk_bits = 11;
+    static constexpr uint32_t chunk_size = 1U << chunk_bits;
+    static constexpr uint32_t max_chunks = 1U << (slot_bits - chunk_bits);
+
+    timer_t* at(uint32_t slot) const
+    {
+        auto& chunk_ptr = chunks_[slot >> chunk_bits];
+        auto chunk = chunk_ptr.load(std::memory_order_acquire);
+        return chunk == nullptr ? nullptr : &chunk[slot & (chunk_size - 1)];
+    }
+
+    // push the list linked by free_next from first to last.
+    void push(timer_t* first, timer_t* last);
+    bool grow();
+
+private:
+    // aba counter << 32 | (slot + 1) of the first free timer.
+    std::atomic<uint64_t> free_{ 0 };
+
+    std::mutex grow_mtx_;
+    std::atomic<uint32_t> chunk_count_{ 0 };
+    std::atomic<timer_t*> chunks_[max_chunks];
+};
+
+inline timer_t* timer_pool::alloc()
+{
+    auto head = free_.load(std::memory_order_acquire);
+    for (;;)
+    {
+        auto index = static_cast<uint32_t>(head);
+        if (index == 0)
+        {
+            if (!grow())
+            {
+                return nullptr;
+            }
+
+            head = free_.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // the next may be stale, then the aba counter fails the CAS.
+        auto timer = at(index - 1);
+        uint64_t next = timer->free_next.load(std::memory_order_relaxed);
+        auto new_head = (((head >> 32) + 1) << 32) | next;
+        if (free_.compare_exchange_weak(head, new_head,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire))
+        {
+            auto gen = timer->tag.load(std::memory_order_relaxed) >> 2;
+            timer->refs.store(1, std::memory_order_relaxed);
+            timer->pending.store(0, std::memory_order_relaxed);
+            timer->tag.store((gen << 2) | timer_t::state_active,
+                             std::memory_order_release);
+            timer->timer_id = (static_cast<timer_id_t>(gen & gen_mask)
+                               << slot_bits) | timer->slot;
+            return timer;
+        }
+    }
+}
+
+inline void timer_pool::free(timer_t* timer)
+{
+    timer->timer_cb = nullptr;
+    timer->persist.reset();
+
+    auto gen = (timer->tag.load(std::memory_order_relaxed) >> 2) + 1;
+    timer->tag.store(gen << 2 | timer_t::state_free,
+                     std::memory_order_release);
+    push(timer, timer);
+}
+
+inline timer_t* timer_pool::find(timer_id_t timer_id) const
+{
+    if (timer_id < 0)
+    {
+        return nullptr;
+    }
+
+    auto slot = static_cast<uint32_t>(timer_id) & ((1U << slot_bits) - 1);
+    auto gen = static_cast<uint32_t>(timer_id >> slot_bits);
+    if (gen > gen_mask)
+    {
+        return nullptr;
+    }
+
+    auto timer = at(slot);
+    if (timer == nullptr)
+    {
+        return nullptr;
+    }
+
+    auto tag = timer->tag.load(std::memory_order_acquire);
+    if (((tag >> 2) & gen_mask) != gen ||
+        (tag & 3U) != timer_t::state_active)
+    {
+        return nullptr;
+    }
+
+    return timer;
+}
+
+inline timer_id_t timer_pool::active_id(uint32_t slot) const
+{
+    auto timer = at(slot);
+    if (timer == nullptr)
+    {
+        return -1;
+    }
+
+    auto tag = timer->tag.load(std::memory_order_acquire);
+    if ((tag & 3U) != timer_t::state_active)
+    {
+        return -1;
+    }
+
+    return (static_cast<timer_id_t>((tag >> 2) & gen_mask) << slot_bits) |
+        slot;
+}
+
+inline void timer_pool::push(timer_t* first, timer_t* last)
+{
+    auto head = free_.load(std::memory_order_relaxed);
+    uint64_t new_head = 0;
+    do
+    {
+        last->free_next.store(static_cast<uint32_t>(head),
+                              std::memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | (first->slot + 1);
+    } while (!free_.compare_exchange_weak(head, new_head,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+}
+
+inline bool timer_pool::grow()
+{
+    std::lock_guard<std::mutex> guard(grow_mtx_);
+    if (static_cast<uint32_t>(free_.load(std::memory_order_acquire)) != 0)
+    {
+        return true; // grown by another thread.
+    }
+
+    auto count = chunk_count_.load(std::memory_order_relaxed);
+    if (count == max_chunks)
+    {
+        return false;
+    }
+
+    auto chunk = new timer_t[chunk_size];
+    for (uint32_t i = 0; i < chunk_size; ++i)
+    {
+        chunk[i].slot = count * chunk_size + i;
+        chunk[i].free_next.store(i + 1 < chunk_size ? chunk[i].slot + 2 : 0,
+                                 std::memory_order_relaxed);
+    }
+
+    chunks_[count].store(chunk, std::memory_order_release);
+    chunk_count_.store(count + 1, std::memory_order_release);
+
+    push(&chunk[0], &chunk[chunk_size - 1]);
+    return true;
+}
+
+// steady clock tick count(milliseconds) on startup.
+inline int64_t tick_count()
+{
+    using namespace std::chrono;
+    auto now_ms = duration_cast<milliseconds>(
+        steady_clock::now().time_since_epoch()).count();
+    return now_ms;
+}
+
+// steady clock tick count(microseconds), the ticks of scheduler.
+inline int64_t tick_count_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+// the clock policy of basic_timer_mgr, now() returns microsecond ticks.
+// a fake clock drives the timers by advance() for deterministic tests.
+struct tick_clock
+{
+    int64_t now() const { return tick_count_us(); }
+};
+
+// the clock of virtual time, it starts at 0 and only moves by set() or
+// advance(), so hours of timers run in milliseconds of a simulation.
+class virtual_clock
+{
+public:
+    virtual_clock() = default;
+    virtual_clock(const virtual_clock& other) noexcept
+        : ticks_(other.now()) {}
+
+    int64_t now() const { return ticks_.load(std::memory_order_acquire); }
+    void set(int64_t now) { ticks_.store(now, std::memory_order_release); }
+    void advance(int64_t delta) { ticks_.fetch_add(delta); }
+
+private:
+    std::atomic<int64_t> ticks_{ 0 };
+};
+
+// the lock policy of a single-threaded basic_timer_mgr, only for the
+// manual_drive mode that all calls are made by the event loop thread.
+struct null_lock
+{
+    void lock() {}
+    void unlock() {}
+    bool try_lock() { return true; }
+};
+
+// the kernel armed waiter of the schedule thread, the deadline is set to
+// the earliest expires and notify() wakes it up for a earlier timer.
+// valid() is false if the platform has none or the handles failed.
+#if defined(__linux__)
+class native_waiter
+{
+public:
+    native_waiter(const native_waiter&) = delete;
+    native_waiter& operator=(const native_waiter&) = delete;
+
+    native_waiter()
+    {
+        // steady_clock is CLOCK_MONOTONIC.
+        timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~native_waiter()
+    {
+        if (timer_fd_ >= 0) ::close(timer_fd_);
+        if (event_fd_ >= 0) ::close(event_fd_);
+    }
+
+    bool valid() const { return timer_fd_ >= 0 && event_fd_ >= 0; }
+
+    // sleep until expires(microsecond ticks) or notified,
+    // the lock is released while sleeping.
+    template <typename Lock>
+    void wait(std::unique_lock<Lock>& lock, int64_t expires)
+    {
+        // a zero time disarms the timer.
+        itimerspec spec{};
+        if (expires != std::numeric_limits<int64_t>::max())
+        {
+            spec.it_value.tv_sec = static_cast<time_t>(expires / 1000000);
+            spec.it_value.tv_nsec = static_cast<long>(expires % 1000000) * 1000;
+        }
+        ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+        // a notify after unlock keeps the eventfd readable.
+        lock.unlock();
+        pollfd fds[2] = { { timer_fd_, POLLIN, 0 }, { event_fd_, POLLIN, 0 } };
+        ::poll(fds, 2, -1);
+
+        uint64_t value = 0;
+        if (::read(timer_fd_, &value, sizeof(value)) < 0) {}
+        if (::read(event_fd_, &value, sizeof(value)) < 0) {}
+        lock.lock();
+    }
+
+    void notify()
+    {
+        uint64_t value = 1;
+        if (::write(event_fd_, &value, sizeof(value)) < 0) {}
+    }
+
+private:
+    int timer_fd_{ -1 };
+    int event_fd_{ -1 };
+};
+#elif defined(_WIN32)
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+class native_waiter
+{
+public:
+    native_waiter(const native_waiter&) = delete;
+    native_waiter& operator=(const native_waiter&) = delete;
+
+    native_waiter()
+    {
+        timer_ = ::CreateWaitableTimerExW(
+            nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+            TIMER_ALL_ACCESS);
+        if (timer_ == nullptr)
+        {
+            // before Windows 10 1803.
+            timer_ = ::CreateWaitableTimerExW(nullptr, nullptr, 0,
+                                              TIMER_ALL_ACCESS);
+        }
+        event_ = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    }
+
+    ~native_waiter()
+    {
+        if (timer_ != nullptr) ::CloseHandle(timer_);
+        if (event_ != nullptr) ::CloseHandle(event_);
+    }
+
+    bool valid() const { return timer_ != nullptr && event_ != nullptr; }
+
+    template <typename Lock>
+    void wait(std::unique_lock<Lock>& lock, int64_t expires)
+    {
+        HANDLE handles[2] = { event_, timer_ };
+        DWORD count = 1;
+        if (expires != std::numeric_limits<int64_t>::max())
+        {
+            // negative due time is relative, in 100 nanoseconds.
+            LARGE_INTEGER due;
+            auto delta = std::max<int64_t>(expires - tick_count_us(), 0);
+            due.QuadPart = -delta * 10;
+            ::SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE);
+            count = 2;
+        }
+
+        lock.unlock();
+        ::WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+        lock.lock();
+    }
+
+    void notify()
+    {
+        ::SetEvent(event_);
+    }
+
+private:
+    HANDLE timer_{ nullptr };
+    HANDLE event_{ nullptr };
+};
+#else
+class native_waiter
+{
+public:
+    bool valid() const { return false; }
+    template <typename Lock>
+    void wait(std::unique_lock<Lock>&, int64_t) {}
+    void notify() {}
+};
+#endif
+
+// scheduler queue: ordered by std::map, O(log n) insert.
+//
+// every queue implements the same members:
+//   push(timer)        insert a timer by timer->expires.
+//   erase(timer)       unlink a queued timer(O(1), O(log n) of the heap).
+//   min_expires()      lower bound of the earliest expired time.
+//   pop_expired(now)   splice all timers expired before now into the bucket.
+//
+// the map allocates a node for every distinct expired time,
+// the wheel_queue never allocates.
+class map_queue
+{
+public:
+    explicit map_queue(int64_t) {}
+
+    void push(timer_t* timer)
+    {
+        buckets_[timer->expires].push_back(timer);
+    }
+
+    void erase(timer_t* timer)
+    {
+        if (timer_bucket::remove(timer) != nullptr)
+        {
+            buckets_.erase(timer->expires);
+        }
+    }
+
+    int64_t min_expires() const
+    {
+        if (buckets_.empty())
+        {
+            return std::numeric_limits<int64_t>::max();
+        }
+
+        return buckets_.begin()->first;
+    }
+
+    void pop_expired(int64_t now, timer_bucket& timers)
+    {
+        auto it = buckets_.begin();
+        while (it != buckets_.end())
+        {
+            if (it->first > now)
+            {
+                break;
+            }
+
+            timers.splice(it->second);
+            it = buckets_.erase(it);
+        }
+    }
+
+private:
+    // key: expired time.
+    expired_timer_buckets buckets_;
+};
+
+// scheduler queue: hierarchical timing wheel, O(1) insert and
+// amortized O(1) expiry, 256/64/64/64/64 slots of 1 tick(microsecond).
+//
+// the wheel covers 2^32 ticks(about 71 minutes), a farther timer is parked
+// in the last slot and re-inserted when that slot is cascaded.
+class wheel_queue
+{
+public:
+    explicit wheel_queue(int64_t now) : cur_(now) {}
+
+    void push(timer_t* timer)
+    {
+        slot(timer->expires).push_back(timer);
+        ++count_;
+    }
+
+    void erase(timer_t* timer);
+
+    int64_t min_expires() const;
+    void pop_expired(int64_t now, timer_bucket& timers);
+
+private:
+    static constexpr int root_bits = 8;
+    static constexpr int level_bits = 6;
+    static constexpr int levels = 5;
+    static constexpr int root_size = 1 << root_bits;
+    static constexpr int level_size = 1 << level_bits;
+    static constexpr int64_t max_delta =
+        (int64_t(1) << (root_bits + (levels - 1) * level_bits)) - 1;
+
+    static int shift(int level)
+    {
+        return level == 0 ? 0 : root_bits + (level - 1) * level_bits;
+    }
+
+    static int slot_index(int level, int64_t expires)
+    {
+        auto mask = level == 0 ? root_size - 1 : level_size - 1;
+        return static_cast<int>((expires >> shift(level)) & mask);
+    }
+
+    // the slot owns expires relative to the current tick.
+    timer_bucket& slot(int64_t expires);
+
+    // re-insert the timers of slot into lower levels.
+    void cascade(int level, int index);
+
+    // first occupied slot at or after index(circular), -1 if none.
+    int next_slot(int level, int index) const;
+
+    // the first tick a occupied upper slot is cascaded.
+    int64_t next_cascade() const;
+
+private:
+    // next tick to process, all ticks before it are expired.
+    int64_t cur_{ 0 };
+    size_t count_{ 0 };
+
+    timer_bucket root_[root_size];
+    timer_bucket wheel_[levels - 1][level_size];
+    // occupied bitmap: root is 4 words, other levels 1 word.
+    uint64_t root_bitmap_[root_size / 64]{};
+    uint64_t wheel_bitmap_[levels - 1]{};
+    // the earliest expires pushed into a occupied upper slot,
+    // so the scheduler sleeps to the deadline instead of the cascade.
+    int64_t wheel_min_[levels - 1][level_size]{};
+};
+
+inline timer_bucket& wheel_queue::slot(int64_t expires)
+{
+    auto delta = expires - cur_;
+    if (delta < 0)
+    {
+        // already expired, fire on the next tick.
+        expires = cur_;
+        delta = 0;
+    }
+    else if (delta > max_delta)
+    {
+        expires = cur_ + max_delta;
+        delta = max_delta;
+    }
+
+    int level = 0;
+    while (level + 1 < levels && delta >> shift(level + 1) != 0)
+    {
+        ++level;
+    }
+
+    auto index = slot_index(level, expires);
+    if (level == 0)
+    {
+        root_bitmap_[index / 64] |= uint64_t(1) << (index % 64);
+        return root_[index];
+    }
+
+    auto bit = uint64_t(1) << index;
+    auto& min = wheel_min_[level - 1][index];
+    if ((wheel_bitmap_[level - 1] & bit) == 0 || expires < min)
+    {
+        min = expires;
+    }
+
+    wheel_bitmap_[level - 1] |= bit;
+    return wheel_[level - 1][index];
+}
+
+inline void wheel_queue::erase(timer_t* timer)
+{
+    --count_;
+    auto bucket = timer_bucket::remove(timer);
+    if (bucket == nullptr)
+    {
+        return;
+    }
+
+    // clear the occupied bit of the empty slot.
+    if (bucket >= root_ && bucket < root_ + root_size)
+    {
+        auto index = bucket - root_;
+        root_bitmap_[index / 64] &= ~(uint64_t(1) << (index % 64));
+        return;
+    }
+
+    auto offset = bucket - &wheel_[0][0];
+    auto bit = uint64_t(1) << (offset % level_size);
+    wheel_bitmap_[offset / level_size] &= ~bit;
+}
+
+inline void wheel_queue::cascade(int level, int index)
+{
+    timer_bucket timers;
+    timers.splice(wheel_[level - 1][index]);
+    wheel_bitmap_[level - 1] &= ~(uint64_t(1) << index);
+
+    while (auto timer = timers.pop_front())
+    {
+        slot(timer->expires).push_back(timer);
+    }
+}
+
+inline int wheel_queue::next_slot(int level, int index) const
+{
+    auto size = level == 0 ? root_size : level_size;
+    for (int i = 0; i < size; ++i)
+    {
+        auto j = (index + i) & (size - 1);
+        auto word = level == 0 ? root_bitmap_[j / 64]
+                               : wheel_bitmap_[level - 1];
+
+        // skip the empty remainder of the word.
+        word >>= (j % 64);
+        if (word == 0)
+        {
+            i += 63 - (j % 64);
+            continue;
+        }
+
+        while ((word & 1) == 0)
+        {
+            word >>= 1;
+            ++i;
+        }
+
+        return (index + i) & (size - 1);
+    }
+
+    return -1;
+}
+
+inline int64_t wheel_queue::next_cascade() const
+{
+    auto result = std::numeric_limits<int64_t>::max();
+    for (int level = 1; level < levels; ++level)
+    {
+        if (wheel_bitmap_[level - 1] == 0)
+        {
+            continue;
+        }
+
+        // the current slot is occupied for the next round.
+        auto index = slot_index(level, cur_);
+        auto found = next_slot(level, (index + 1) & (level_size - 1));
+        int64_t slots = (found - index) & (level_size - 1);
+        slots = slots == 0 ? level_size : slots;
+
+        auto start = ((cur_ >> shift(level)) + slots) << shift(level);
+        result = std::min(result, start);
+    }
+
+    return result;
+}
+
+inline int64_t wheel_queue::min_expires() const
+{
+    if (count_ == 0)
+    {
+        return std::numeric_limits<int64_t>::max();
+    }
+
+    auto result = std::numeric_limits<int64_t>::max();
+
+    // root slots are exact.
+    auto root_index = slot_index(0, cur_);
+    auto found = next_slot(0, root_index);
+    if (found >= 0)
+    {
+        result = cur_ + ((found - root_index) & (root_size - 1));
+    }
+
+    // the first occupied upper slot of a level holds the earliest timers
+    // of that level, the slot is cascaded before its earliest expires.
+    // the current slots are not cascaded yet if cur_ is on their boundary.
+    auto pending = root_index == 0;
+    for (int level = 1; level < levels; ++level)
+    {
+        auto index = slot_index(level, cur_);
+        found = next_slot(level, pending ? index
+                                         : (index + 1) & (level_size - 1));
+        pending = pending && index == 0;
+        if (found < 0)
+        {
+            continue;
+        }
+
+        result = std::min(result, wheel_min_[level - 1][found]);
+    }
+
+    return result;
+}
+
+inline void wheel_queue::pop_expired(int64_t now, timer_bucket& timers)
+{
+    while (cur_ <= now)
+    {
+        if (count_ == 0)
+        {
+            cur_ = now + 1;
+            return;
+        }
+
+        auto index = slot_index(0, cur_);
+        if (index == 0)
+        {
+            // cascade the upper levels top-down when the lower level wraps.
+            int top = 1;
+            while (top + 1 < levels && slot_index(top, cur_) == 0)
+            {
+                ++top;
+            }
+
+            for (int level = top; level >= 1; --level)
+            {
+                cascade(level, slot_index(level, cur_));
+            }
+        }
+
+        if ((root_bitmap_[0] | root_bitmap_[1] |
+             root_bitmap_[2] | root_bitmap_[3]) == 0)
+        {
+            // all timers are in upper slots, skip the empty ticks.
+            cur_ = std::min(next_cascade(), now + 1);
+            continue;
+        }
+
+        auto& bucket = root_[index];
+        if (!bucket.empty())
+        {
+            while (auto timer = bucket.pop_front())
+            {
+                timers.push_back(timer);
+                --count_;
+            }
+
+            root_bitmap_[index / 64] &= ~(uint64_t(1) << (index % 64));
+        }
+
+        // jump over the empty root slots until the next cascade.
+        auto found = next_slot(0, index + 1 < root_size ? index + 1 : 0);
+        auto step = found > index ? found - index : root_size - index;
+        cur_ = std::min(cur_ + step, now + 1);
+    }
+}
+
+// scheduler queue: 4-ary min-heap in a contiguous array, O(log n) insert
+// and erase. the smallest memory for a few thousands of timers, the
+// entries keep the keys together instead of chasing the timer nodes.
+//
+// the timers of same expired time fire in the insertion order.
+class heap_queue
+{
+public:
+    explicit heap_queue(int64_t) {}
+
+    void push(timer_t* timer)
+    {
+        heap_.push_back(entry{ timer->expires, seq_++, timer });
+        sift_up(heap_.size() - 1);
+    }
+
+    void erase(timer_t* timer);
+
+    int64_t min_expires() const
+    {
+        return heap_.empty() ? std::numeric_limits<int64_t>::max()
+                             : heap_.front().expires;
+    }
+
+    void pop_expired(int64_t now, timer_bucket& timers);
+
+private:
+    static constexpr size_t arity = 4;
+
+    struct entry
+    {
+        int64_t  expires;
+        uint64_t seq;
+        timer_t* timer;
+
+        bool operator<(const entry& other) const
+        {
+            return expires < other.expires ||
+                (expires == other.expires && seq < other.seq);
+        }
+    };
+
+    void place(size_t index, const entry& item)
+    {
+        heap_[index] = item;
+        item.timer->heap_index = static_cast<uint32_t>(index);
+    }
+
+    void sift_up(size_t index);
+    void sift_down(size_t index);
+
+private:
+    std::vector<entry> heap_;
+    uint64_t seq_{ 0 };
+};
+
+inline void heap_queue::erase(timer_t* timer)
+{
+    size_t index = timer->heap_index;
+    auto last = heap_.back();
+    heap_.pop_back();
+    if (index == heap_.size())
+    {
+        return;
+    }
+
+    // move the last entry into the hole, either way it goes.
+    place(index, last);
+    if (index > 0 && last < heap_[(index - 1) / arity])
+    {
+        sift_up(index);
+    }
+    else
+    {
+        sift_down(index);
+    }
+}
+
+inline void heap_queue::pop_expired(int64_t now, timer_bucket& timers)
+{
+    while (!heap_.empty() && heap_.front().expires <= now)
+    {
+        timers.push_back(heap_.front().timer);
+
+        auto last = heap_.back();
+        heap_.pop_back();
+        if (!heap_.empty())
+        {
+            place(0, last);
+            sift_down(0);
+        }
+    }
+}
+
+inline void heap_queue::sift_up(size_t index)
+{
+    auto item = heap_[index];
+    while (index > 0)
+    {
+        auto parent = (index - 1) / arity;
+        if (!(item < heap_[parent]))
+        {
+            break;
+        }
+
+        place(index, heap_[parent]);
+        index = parent;
+    }
+
+    place(index, item);
+}
+
+inline void heap_queue::sift_down(size_t index)
+{
+    auto item = heap_[index];
+    auto size = heap_.size();
+    for (;;)
+    {
+        auto first = index * arity + 1;
+        if (first >= size)
+        {
+            break;
+        }
+
+        // the smallest of the children.
+        auto child = first;
+        auto end = std::min(first + arity, size);
+        for (auto i = first + 1; i < end; ++i)
+        {
+            if (heap_[i] < heap_[child])
+            {
+                child = i;
+            }
+        }
+
+        if (!(heap_[child] < item))
+        {
+            break;
+        }
+
+        place(index, heap_[child]);
+        index = child;
+    }
+
+    place(index, item);
+}
+
+// apply the options to the calling thread, the pool threads are named
+// name-index. return false if one of them is not applied.
+inline bool apply_thread_options(const timer_thread_options& options,
+                                 const char* default_name, int index = -1)
+{
+    auto name = options.name.empty() ? std::string(default_name)
+                                     : options.name;
+    if (index >= 0)
+    {
+        name += "-" + std::to_string(index);
+    }
+
+    auto result = true;
+#if defined(__linux__)
+    result = ::pthread_setname_np(::pthread_self(),
+                                  name.substr(0, 15).c_str()) == 0;
+
+    if (!options.cpus.empty())
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (auto cpu : options.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        result = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus),
+                                          &cpus) == 0 && result;
+    }
+
+    if (options.priority > 0)
+    {
+        sched_param param{};
+        param.sched_priority = std::min<int>(
+            options.priority, ::sched_get_priority_max(SCHED_FIFO));
+        result = ::pthread_setschedparam(::pthread_self(), SCHED_FIFO,
+                                         &param) == 0 && result;
+    }
+#elif defined(_WIN32)
+    // SetThreadDescription is only on Windows 10 1607 or later.
+    using set_description_fn = HRESULT(WINAPI*)(HANDLE, PCWSTR);
+    auto set_description = reinterpret_cast<set_description_fn>(
+        ::GetProcAddress(::GetModuleHandleW(L"kernel32.dll"),
+                         "SetThreadDescription"));
+    if (set_description != nullptr)
+    {
+        std::wstring wide(name.begin(), name.end());
+        result = SUCCEEDED(set_description(::GetCurrentThread(),
+                                           wide.c_str()));
+    }
+
+    if (!options.cpus.empty())
+    {
+        DWORD_PTR mask = 0;
+        for (auto cpu : options.cpus)
+        {
+            if (cpu >= 0 && cpu < static_cast<int>(sizeof(mask) * 8))
+            {
+                mask |= DWORD_PTR(1) << cpu;
+            }
+        }
+
+        result = ::SetThreadAffinityMask(::GetCurrentThread(), mask) != 0 &&
+            result;
+    }
+
+    if (options.priority > 0)
+    {
+        result = ::SetThreadPriority(::GetCurrentThread(),
+                                     THREAD_PRIORITY_TIME_CRITICAL) &&
+            result;
+    }
+#else
+    result = options.cpus.empty() && options.priority <= 0;
+#endif
+
+    return result;
+}
+
+// manual_drive mode: run callbacks on the thread calling advance().
+class inline_executor : public timer_executor
+{
+public:
+    using timer_executor::post;
+
+    void post(const timer_task* tasks, size_t count) override
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            tasks[i]();
+        }
+    }
+};
+
+// the default executor, run callbacks in a dedicated event thread.
+class event_thread : public timer_executor
+{
+public:
+    event_thread(const event_thread&) = delete;
+    event_thread& operator=(const event_thread&) = delete;
+
+    explicit event_thread(
+        const timer_thread_options& options = timer_thread_options(),
+        const char* default_name = "timer-event")
+        : options_(options), default_name_(default_name)
+    {
+        event_thd_ = std::thread(&event_thread::run_timer_event, this);
+    }
+
+    ~event_thread() noexcept
+    {
+        shutdown(timer_drain::discard, {});
+    }
+
+    size_t shutdown(timer_drain drain,
+                    std::chrono::steady_clock::time_point deadline) override
+    {
+        if (!event_thd_.joinable())
+        {
+            return 0;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(event_mtx_);
+            drain_ = drain;
+            drain_deadline_ = deadline;
+            stop_.store(true);
+            event_cv_.notify_one();
+        }
+
+        event_thd_.join();
+        return dropped_;
+    }
+
+    void post(const timer_task* tasks, size_t count) override
+    {
+        post(timer_lane::normal, tasks, count);
+    }
+
+    void post(timer_lane lane, const timer_task* tasks,
+              size_t count) override
+    {
+        // timer callback will run in another thread.
+        // Avoiding prolonged execution of callbacks that affect timer accuracy.
+        std::lock_guard<std::mutex> guard(event_mtx_);
+        auto notify = queued() == 0;
+        auto& events = timer_events_[static_cast<size_t>(lane)];
+        events.insert(events.end(), tasks, tasks + count);
+
+        if (lane == timer_lane::high)
+        {
+            high_pending_.store(true, std::memory_order_relaxed);
+        }
+
+        if (notify)
+        {
+            event_cv_.notify_one();
+        }
+    }
+
+private:
+    void run_timer_event();
+    // run the high lane posted while a lower batch is running.
+    void run_high_lane();
+    // run a batch of tasks, preempt by the high lane if it is lower.
+    void run_batch(std::vector<timer_task>& timers, bool preempt);
+
+    size_t queued() const
+    {
+        size_t count = 0;
+        for (auto& events : timer_events_)
+        {
+            count += events.size();
+        }
+
+        return count;
+    }
+
+    // shutdown: keep running the tasks.
+    bool draining() const
+    {
+        return drain_ == timer_drain::run &&
+            std::chrono::steady_clock::now() < drain_deadline_;
+    }
+
+private:
+    timer_thread_options options_;
+    const char* default_name_;
+    std::atomic_bool stop_{ false };
+    // written before stop_, dropped_ is read after join.
+    timer_drain drain_{ timer_drain::discard };
+    std::chrono::steady_clock::time_point drain_deadline_;
+    size_t dropped_{ 0 };
+
+    std::mutex event_mtx_;
+    std::thread event_thd_;
+    std::condition_variable event_cv_;
+    // double buffered with the running batch, swapped under the lock,
+    // the capacity is kept so the hand-off never allocates.
+    std::vector<timer_task> timer_events_[timer_lanes];
+    // the high lane is posted, checked between the lower callbacks.
+    std::atomic_bool high_pending_{ false };
+    std::vector<timer_task> high_batch_;
+};
+
+inline void event_thread::run_timer_event()
+{
+    apply_thread_options(options_, default_name_);
+    std::vector<timer_task> timers;
+
+    for (;;)
+    {
+        size_t lane = 0;
+        {
+            std::unique_lock<std::mutex> lock(event_mtx_);
+            event_cv_.wait(lock, [this]()
+            {
+                return stop_.load() || queued() != 0;
+            });
+
+            if (stop_.load() && (queued() == 0 || !draining()))
+            {
+                // timer is stoped, drop the callbacks not run.
+                dropped_ += queued();
+                for (auto& events : timer_events_)
+                {
+                    events.clear();
+                }
+
+                return;
+            }
+
+            // the highest lane first.
+            while (timer_events_[lane].empty())
+            {
+                ++lane;
+            }
+
+            if (lane == 0)
+            {
+                high_pending_.store(false, std::memory_order_relaxed);
+            }
+
+            timers.swap(timer_events_[lane]);
+        }
+
+        run_batch(timers, lane != 0);
+        timers.clear();
+    }
+}
+
+inline void event_thread::run_batch(std::vector<timer_task>& timers,
+                                    bool preempt)
+{
+    for (size_t i = 0; i < timers.size(); ++i)
+    {
+        // a high callback posted meanwhile runs before the rest.
+        if (preempt && high_pending_.load(std::memory_order_relaxed))
+        {
+            run_high_lane();
+        }
+
+        if (stop_.load() && !draining())
+        {
+            dropped_ += timers.size() - i;
+            return;
+        }
+
+        timers[i]();
+    }
+}
+
+inline void event_thread::run_high_lane()
+{
+    {
+        std::lock_guard<std::mutex> guard(event_mtx_);
+        high_pending_.store(false, std::memory_order_relaxed);
+        high_batch_.swap(timer_events_[0]);
+    }
+
+    run_batch(high_batch_, false);
+    high_batch_.clear();
+}
+
+// the executor of multiple threads, every worker owns a deque,
+// pops from the front of its own and steals from the back of others.
+class event_pool : public timer_executor
+{
+public:
+    event_pool(const event_pool&) = delete;
+    event_pool& operator=(const event_pool&) = delete;
+
+    explicit event_pool(
+        int32_t threads,
+        const timer_thread_options& options = timer_thread_options())
+        : options_(options), workers_(std::max(threads, 1))
+    {
+        for (size_t i = 0; i < workers_.size(); ++i)
+        {
+            workers_[i].thd = std::thread(&event_pool::work, this, i);
+        }
+    }
+
+    ~event_pool() noexcept
+    {
+        shutdown(timer_drain::discard, {});
+    }
+
+    // spread the tasks over the workers, one lock of every deque.
+    void post(const timer_task* tasks, size_t count) override;
+    // the high lane is pushed to the front of the deques, background
+    // ones run when no other task is left.
+    void post(timer_lane lane, const timer_task* tasks,
+              size_t count) override;
+
+    size_t shutdown(timer_drain drain,
+                    std::chrono::steady_clock::time_point deadline) override;
+
+private:
+    struct worker
+    {
+        std::mutex mtx;
+        std::deque<timer_task> tasks;
+        std::deque<timer_task> background;
+        std::thread thd;
+    };
+
+    void work(size_t index);
+    bool take(size_t index, timer_task& task);
+
+    // shutdown: keep running the tasks.
+    bool draining() const
+    {
+        return drain_ == timer_drain::run &&
+            std::chrono::steady_clock::now() < drain_deadline_;
+    }
+
+private:
+    timer_thread_options options_;
+    std::vector<worker> workers_;
+    size_t next_{ 0 };
+
+    std::atomic_bool stop_{ false };
+    // written before stop_.
+    timer_drain drain_{ timer_drain::discard };
+    std::chrono::steady_clock::time_point drain_deadline_;
+    std::atomic<size_t> queued_{ 0 };
+    std::mutex idle_mtx_;
+    std::condition_variable idle_cv_;
+};
+
+inline void event_pool::post(const timer_task* tasks, size_t count)
+{
+    post(timer_lane::normal, tasks, count);
+}
+
+inline void event_pool::post(timer_lane lane, const timer_task* tasks,
+                             size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // count first, a worker never sees more tasks than queued_.
+    queued_.fetch_add(count);
+
+    auto chunk = (count + workers_.size() - 1) / workers_.size();
+    for (size_t posted = 0; posted < count; posted += chunk)
+    {
+        auto& target = workers_[next_++ % workers_.size()];
+        auto first = tasks + posted;
+        auto last = tasks + std::min(count, posted + chunk);
+
+        std::lock_guard<std::mutex> guard(target.mtx);
+        if (lane == timer_lane::high)
+        {
+            target.tasks.insert(target.tasks.begin(), first, last);
+        }
+        else if (lane == timer_lane::background)
+        {
+            target.background.insert(target.background.end(), first, last);
+        }
+        else
+        {
+            target.tasks.insert(target.tasks.end(), first, last);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(idle_mtx_);
+    if (count < workers_.size())
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            idle_cv_.notify_one();
+        }
+    }
+    else
+    {
+        idle_cv_.notify_all();
+    }
+}
+
+inline size_t event_pool::shutdown(
+    timer_drain drain, std::chrono::steady_clock::time_point deadline)
+{
+    if (stop_.load())
+    {
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(idle_mtx_);
+        drain_ = drain;
+        drain_deadline_ = deadline;
+        stop_.store(true);
+        idle_cv_.notify_all();
+    }
+
+    for (auto& worker : workers_)
+    {
+        worker.thd.join();
+    }
+
+    size_t dropped = 0;
+    for (auto& worker : workers_)
+    {
+        std::lock_guard<std::mutex> guard(worker.mtx);
+        dropped += worker.tasks.size() + worker.background.size();
+        worker.tasks.clear();
+        worker.background.clear();
+    }
+
+    queued_.store(0);
+    return dropped;
+}
+
+inline bool event_pool::take(size_t index, timer_task& task)
+{
+    // the background tasks after all others.
+    for (size_t i = 0; i < workers_.size() * 2; ++i)
+    {
+        auto& target = workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> guard(target.mtx);
+        auto& tasks = i < workers_.size() ? target.tasks
+                                          : target.background;
+        if (tasks.empty())
+        {
+            continue;
+        }
+
+        if (i % workers_.size() == 0)
+        {
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        else
+        {
+            // steal from the back of other worker.
+            task = tasks.back();
+            tasks.pop_back();
+        }
+
+        queued_.fetch_sub(1);
+        return true;
+    }
+
+    return false;
+}
+
+inline void event_pool::work(size_t index)
+{
+    apply_thread_options(options_, "timer-event", static_cast<int>(index));
+    while (!stop_.load() || draining())
+    {
+        timer_task task;
+        if (take(index, task))
+        {
+            task();
+            continue;
+        }
+
+        if (stop_.load())
+        {
+            break; // drained.
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mtx_);
+        idle_cv_.wait(lock, [this]()
+        {
+            return stop_.load() || queued_.load() != 0;
+        });
+    }
+}
+
+// the scheduler policies are compile time parameters:
+// Queue: wheel_queue or map_queue.
+// Clock: now() of microsecond ticks, e.g. tick_clock.
+// Lock: the mutex guarding the scheduler, null_lock for manual_drive.
+template <typename Queue, typename Clock = tick_clock,
+          typename Lock = std::mutex>
+class basic_timer_mgr final : public timer_iface
+{
+public:
+    using timer_iface::create_timer;
+    using timer_iface::create_repeat_timer;
+
+    timer_id_t create_timer(int32_t msec, timer_callback cb) override;
+    timer_id_t create_repeat_timer(int32_t msec, int32_t repeat,
+                                   timer_callback cb) override;
+
+    timer_id_t create_timer(std::chrono::microseconds delay,
+                            timer_callback cb) override;
+    timer_id_t create_repeat_timer(std::chrono::microseconds interval,
+                                   int32_t repeat,
+                                   timer_callback cb) override;
+    timer_id_t create_timer(const timer_spec& spec,
+                            timer_callback cb) override;
+    size_t create_timers(const timer_spec* specs, timer_callback* cbs,
+                         size_t count, timer_id_t* ids) override;
+
+    bool cancel_timer(timer_id_t timer_id) override;
+    size_t cancel_timers(const timer_id_t* ids, size_t count) override;
+
+    bool reset_timer(timer_id_t timer_id, int32_t msec) override;
+    bool reset_timer(timer_id_t timer_id,
+                     std::chrono::microseconds delay) override;
+    bool postpone_timer(timer_id_t timer_id, int32_t msec) override;
+    bool postpone_timer(timer_id_t timer_id,
+                        std::chrono::microseconds delta) override;
+
+    timer_stats stats() const override;
+
+    size_t shutdown(timer_drain drain = timer_drain::discard,
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::time_point::max())
+        override;
+
+    // manual_drive mode, called by one thread of the application.
+    // the milliseconds until the earliest timer expired(0 if expired),
+    // -1 if there is no timer, can be passed to epoll_wait directly.
+    int32_t next_timeout();
+    // fire all timers expired before now(clock().now()), return the
+    // callbacks fired. the callbacks may create or cancel timers but
+    // not call advance().
+    size_t advance();
+    size_t advance(int64_t now);
+    // virtual time: step the clock to every deadline within delta and
+    // fire the timers in deadline order, the timers created by callbacks
+    // in the window fire too. the clock needs set(), e.g. virtual_clock.
+    size_t advance(std::chrono::microseconds delta);
+
+    // pause all timers, resume() shifts every deadline by the paused
+    // time in O(1). return false if it is paused(or running) already.
+    bool pause();
+    bool resume();
+    bool paused() const { return frozen_.load() != not_paused; }
+
+    // the clock policy, e.g. to move a fake clock.
+    Clock& clock() { return clock_; }
+
+    // persistent timers: a timer of a callback key of registry is saved
+    // with its wall-clock deadline, interval and the repeats left, and
+    // restore_timers makes the callbacks by the keys again(e.g. after a
+    // restart), the deadlines missed are caught up by the catch_up policy.
+    timer_id_t create_persistent_timer(const timer_spec& spec,
+                                       const timer_registry& registry,
+                                       const std::string& key,
+                                       const std::string& data =
+                                           std::string());
+    // save the pending persistent timers into path, the file is replaced
+    // atomically. return the timers saved, -1 if failed. a timer fired
+    // while saving may fire once more after restore.
+    int64_t save_timers(const std::string& path);
+    // create the timers saved in path at once, the timers of unknown keys
+    // are skipped, ids maps the saved ids to the new ones. return the
+    // timers created, -1 if the file is not valid.
+    int64_t restore_timers(const std::string& path,
+                           const timer_registry& registry,
+                           std::map<timer_id_t, timer_id_t>* ids = nullptr);
+
+public:
+    basic_timer_mgr(const basic_timer_mgr&) = delete;
+    basic_timer_mgr& operator=(const basic_timer_mgr&) = delete;
+
+    explicit basic_timer_mgr(
+        const timer_options& options = timer_options(),
+        const Clock& clock = Clock()) noexcept
+        : options_(options), clock_(clock), queue_(clock_.now())
+    {
+        // a null_lock has no thread to guard against.
+        assert((options_.manual_drive ||
+                !std::is_same<Lock, null_lock>::value));
+
+        executor_ = options_.executor;
+        if (executor_ == nullptr)
+        {
+            if (options_.manual_drive)
+            {
+                own_executor_.reset(new inline_executor());
+            }
+            else if (options_.executor_threads > 1)
+            {
+                own_executor_.reset(new event_pool(
+                    options_.executor_threads, options_.executor_thread));
+            }
+            else
+            {
+                own_executor_.reset(
+                    new event_thread(options_.executor_thread));
+            }
+
+            executor_ = own_executor_.get();
+        }
+
+        for (size_t i = 0; i < timer_lanes; ++i)
+        {
+            lane_executors_[i] = executor_;
+        }
+
+        if (options_.lane_threads && !options_.manual_drive)
+        {
+            lane_threads_[0].reset(
+                new event_thread(options_.executor_thread, "timer-high"));
+            lane_threads_[2].reset(new event_thread(
+                options_.executor_thread, "timer-background"));
+            lane_executors_[0] = lane_threads_[0].get();
+            lane_executors_[2] = lane_threads_[2].get();
+        }
+
+        if (options_.backend == timer_backend::native &&
+            !options_.manual_drive)
+        {
+            native_waiter_.reset(new native_waiter());
+            if (!native_waiter_->valid())
+            {
+                native_waiter_.reset(); // fall back to condition_variable.
+            }
+        }
+
+        stop_.store(false);
+        if (!options_.manual_drive)
+        {
+            schedule_thd_ = std::thread(&basic_timer_mgr::schedule, this);
+        }
+    }
+
+    virtual ~basic_timer_mgr() noexcept
+    {
+        shutdown(timer_drain::discard, {});
+
+        // stop the executor before the timers are freed.
+        own_executor_.reset();
+        for (auto& thread : lane_threads_)
+        {
+            thread.reset();
+        }
+    }
+
+private:
+    timer_id_t setup_timer(const timer_spec& spec, timer_callback cb,
+                           std::unique_ptr<timer_persist> persist = nullptr);
+    void init_timer(timer_t* timer, const timer_spec& spec,
+                    timer_callback cb, int64_t now);
+    void setup_timer(timer_t* timer);
+    // schedule the timers allocated together, only the earliest one wakes
+    // up the scheduler. return the count of timers.
+    size_t setup_timers(const std::vector<timer_t*>& timers);
+
+    // drop a reference of timer, free it by the last one.
+    void release_timer(timer_t* timer);
+
+    // find a timer of id and add a reference, nullptr if it's freed.
+    timer_t* acquire_timer(timer_id_t timer_id);
+    // acquire and mark a timer canceled, nullptr if it is not active.
+    timer_t* mark_canceled(timer_id_t timer_id);
+    // async_submit mode: count the cancels, wake up by a batch of them.
+    void add_cancel_backlog(uint32_t count);
+    // unlink a canceled timer from the queue under schedule_mtx_,
+    // the caller drops the reference of queue if it's unlinked.
+    bool unschedule_timer(timer_t* timer);
+
+    // set the deadline to now + usec or postpone it by usec.
+    bool reschedule_timer(timer_id_t timer_id, int64_t usec, bool postpone);
+
+    // timer schedule task thread.
+    void schedule();
+
+    // run the callback of a expired timer on executor thread.
+    void run_timer(timer_t* timer, int64_t posted);
+#ifdef UTILITY_TIMER_TRACE
+    // pass a event of timer to options_.trace_sink.
+    void trace(timer_trace_point point, const timer_t* timer, int64_t time,
+               int64_t deadline) const;
+#endif
+    static void run_task(void* owner, void* timer, int64_t posted);
+
+    // the timers pushed to or removed from queue_, under lock_schedule.
+    void count_pending(int64_t delta);
+
+    // lock schedule_mtx_ if the scheduler state is shared with callers.
+    std::unique_lock<Lock> lock_schedule();
+
+    // async_submit mode: push a timer, drain them on schedule thread.
+    void submit(timer_t* timer);
+    void drain_submits();
+
+    // calc timer expired time, rounded up to the largest power of 2
+    // microseconds within slack so the close deadlines share a tick.
+    static int64_t calc_expired_time(int64_t deadline, int64_t slack);
+    // a repeat timer of no interval would fire in a busy loop.
+    static bool valid_spec(const timer_spec& spec)
+    {
+        return spec.interval.count() > 0 || spec.repeat == 1;
+    }
+
+    // fire the timers expired before now, return the callbacks posted.
+    size_t poll_expired_timers(int64_t now);
+    void get_expired_timers(int64_t now, timer_bucket& timers);
+    size_t process_expired_timers(int64_t now, timer_bucket& timers);
+    // count a callback into the executor queue, or apply the overload
+    // policy if it is full. false if the callback is not posted.
+    bool admit_callback(timer_t* timer, int64_t posted);
+    // hand the callbacks collected to the executor, return the count.
+    // the pass is one batch in the stats, with the ones flushed before.
+    size_t post_callbacks();
+    size_t flush_callbacks();
+
+    int64_t get_min_expired_time();
+
+    // sleep until the earliest timer expired or a earlier timer setup.
+    void wait_expired_time();
+
+    // the backend of wait_expired_time, called under schedule_mtx_.
+    void sleep_schedule(std::unique_lock<Lock>& lock, int64_t expires);
+    void notify_schedule();
+
+    // the time of scheduler: the clock less the paused time,
+    // it stands still while paused.
+    int64_t schedule_now() const
+    {
+        auto frozen = frozen_.load();
+        return frozen != not_paused ? frozen
+                                    : clock_.now() - offset_.load();
+    }
+
+private:
+    timer_options options_;
+    Clock clock_;
+    std::atomic_bool stop_{ true };
+    // shutdown() is called, no timer is created.
+    std::atomic_bool closed_{ false };
+    // shutdown(timer_drain::discard), the overload drops the callbacks.
+    std::atomic_bool discard_{ false };
+
+    // pause(): the schedule time when paused, the offset is stored before
+    // it is cleared by resume(), so the schedule time never goes back.
+    static constexpr int64_t not_paused = std::numeric_limits<int64_t>::min();
+    std::atomic<int64_t> frozen_{ not_paused };
+    std::atomic<int64_t> offset_{ 0 };
+
+    // timer schedule thread.
+    Lock schedule_mtx_;
+    std::thread schedule_thd_;
+
+    // use condition_variable to simulate sleep_for
+    // because the sleep_for is not reliable on windows.
+    typename std::conditional<std::is_same<Lock, std::mutex>::value,
+        std::condition_variable,
+        std::condition_variable_any>::type schedule_cv_;
+    // timer_backend::native, nullptr uses schedule_cv_.
+    std::unique_ptr<native_waiter> native_waiter_;
+    // the schedule thread sleeps until this time, notify it
+    // when a timer expired before. int64 min means it is awake.
+    std::atomic<int64_t> wakeup_time_{ std::numeric_limits<int64_t>::min() };
+
+    // async_submit mode: the created and canceled timers, wake up the
+    // schedule thread to unlink them after a batch of cancels.
+    static constexpr uint32_t cancel_batch = 1024;
+    mpsc_queue submits_;
+    std::atomic<uint32_t> cancel_backlog_{ 0 };
+    std::atomic<uint64_t> wakeups_{ 0 };
+    std::atomic<uint64_t> batches_{ 0 };
+    std::atomic<uint64_t> batched_events_{ 0 };
+    std::atomic<uint64_t> max_batch_{ 0 };
+    // the callbacks due but not started, and the overload counters.
+    std::atomic<uint64_t> queued_callbacks_{ 0 };
+    std::atomic<uint64_t> dropped_callbacks_{ 0 };
+    std::atomic<uint64_t> inline_callbacks_{ 0 };
+    // block: the schedule thread waits for room.
+    std::atomic_bool overload_waiting_{ false };
+    std::mutex overload_mtx_;
+    std::condition_variable overload_cv_;
+#ifndef UTILITY_TIMER_NO_STATS
+    int64_t created_{ clock_.now() };
+    std::atomic<uint64_t> pending_timers_{ 0 };
+    histogram_recorder lateness_;
+    histogram_recorder queue_delay_;
+    histogram_recorder run_time_;
+#endif
+
+    // the timer objects, the id is the slot of pool.
+    timer_pool pool_;
+    // the scheduler queue ordered by expired time.
+    Queue queue_;
+
+    // the expired timers are posted to the executor,
+    // the task runs the callback by reference.
+    timer_executor* executor_{ nullptr };
+    std::unique_ptr<timer_executor> own_executor_;
+    // the executor of every lane, lane_threads owns the dedicated ones.
+    timer_executor* lane_executors_[timer_lanes]{};
+    std::unique_ptr<timer_executor> lane_threads_[timer_lanes];
+    // the batch of expired timers, reused by the schedule thread.
+    // the callbacks expired of every lane, posted high first.
+    std::vector<timer_task> expired_tasks_[timer_lanes];
+    // flushed in the pass by the block overload, not counted yet.
+    size_t flushed_callbacks_{ 0 };
+};
+
+template <typename Queue, typename Clock, typename Lock>
+inline int64_t
+basic_timer_mgr<Queue, Clock, Lock>::calc_expired_time(int64_t deadline,
+                                                       int64_t slack)
+{
+    if (slack <= 0)
+    {
+        return deadline;
+    }
+
+    int64_t grain = 1;
+    while (grain <= slack / 2)
+    {
+        grain <<= 1;
+    }
+
+    return (deadline + grain - 1) & ~(grain - 1);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t
+basic_timer_mgr<Queue, Clock, Lock>::create_timer(int32_t msec,
+                                                  timer_callback cb)
+{
+    timer_spec spec;
+    spec.interval = std::chrono::milliseconds(msec);
+    return setup_timer(spec, std::move(cb));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t basic_timer_mgr<Queue, Clock, Lock>::create_repeat_timer(
+    int32_t msec, int32_t repeat, timer_callback cb)
+{
+    timer_spec spec;
+    spec.interval = std::chrono::milliseconds(msec);
+    spec.repeat = repeat;
+    return setup_timer(spec, std::move(cb));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t basic_timer_mgr<Queue, Clock, Lock>::create_timer(
+    std::chrono::microseconds delay, timer_callback cb)
+{
+    timer_spec spec;
+    spec.interval = delay;
+    return setup_timer(spec, std::move(cb));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t basic_timer_mgr<Queue, Clock, Lock>::create_repeat_timer(
+    std::chrono::microseconds interval, int32_t repeat, timer_callback cb)
+{
+    timer_spec spec;
+    spec.interval = interval;
+    spec.repeat = repeat;
+    return setup_timer(spec, std::move(cb));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t
+basic_timer_mgr<Queue, Clock, Lock>::create_timer(const timer_spec& spec,
+                                                  timer_callback cb)
+{
+    return setup_timer(spec, std::move(cb));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::cancel_timer(timer_id_t timer_id)
+{
+    auto timer = mark_canceled(timer_id);
+    if (timer == nullptr)
+    {
+        return false;
+    }
+
+    if (options_.async_submit)
+    {
+        // the schedule thread unlinks it and drops our reference.
+        submits_.push(&timer->cancel_cmd);
+        add_cancel_backlog(1);
+        return true;
+    }
+
+    auto unlinked = false;
+    {
+        auto lock = lock_schedule();
+        unlinked = unschedule_timer(timer);
+    }
+
+    // free the callback out of the lock.
+    if (unlinked)
+    {
+        release_timer(timer);
+    }
+
+    release_timer(timer);
+    return true;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t
+basic_timer_mgr<Queue, Clock, Lock>::cancel_timers(const timer_id_t* ids,
+                                                   size_t count)
+{
+    std::vector<timer_t*> timers;
+    timers.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (auto timer = mark_canceled(ids[i]))
+        {
+            timers.push_back(timer);
+        }
+    }
+
+    if (timers.empty())
+    {
+        return 0;
+    }
+
+    if (options_.async_submit)
+    {
+        // push the cancel commands as one chain.
+        for (size_t i = 0; i + 1 < timers.size(); ++i)
+        {
+            timers[i]->cancel_cmd.mpsc_next.store(&timers[i + 1]->cancel_cmd,
+                                                  std::memory_order_relaxed);
+        }
+
+        submits_.push(&timers.front()->cancel_cmd, &timers.back()->cancel_cmd);
+        add_cancel_backlog(static_cast<uint32_t>(timers.size()));
+        return timers.size();
+    }
+
+    // unlink all under one lock, free the callbacks out of it.
+    std::vector<timer_t*> unlinked;
+    {
+        auto lock = lock_schedule();
+        for (auto timer : timers)
+        {
+            if (unschedule_timer(timer))
+            {
+                unlinked.push_back(timer);
+            }
+        }
+    }
+
+    for (auto timer : unlinked)
+    {
+        release_timer(timer);
+    }
+
+    for (auto timer : timers)
+    {
+        release_timer(timer);
+    }
+
+    return timers.size();
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_t*
+basic_timer_mgr<Queue, Clock, Lock>::mark_canceled(timer_id_t timer_id)
+{
+    auto timer = acquire_timer(timer_id);
+    if (timer == nullptr)
+    {
+        return nullptr;
+    }
+
+    // mark the timer canceled without lock, the expired, running and
+    // queued callback events see it.
+    auto tag = timer->tag.load(std::memory_order_acquire);
+    while ((tag & 3U) == timer_t::state_active)
+    {
+        auto value = (tag & ~3U) | timer_t::state_canceled;
+        if (timer->tag.compare_exchange_weak(tag, value,
+                                             std::memory_order_acq_rel))
+        {
+            return timer;
+        }
+    }
+
+    release_timer(timer);
+    return nullptr;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void
+basic_timer_mgr<Queue, Clock, Lock>::add_cancel_backlog(uint32_t count)
+{
+    auto backlog = cancel_backlog_.fetch_add(count, std::memory_order_relaxed);
+    if (backlog < cancel_batch && backlog + count >= cancel_batch)
+    {
+        std::lock_guard<Lock> guard(schedule_mtx_);
+        notify_schedule();
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::reset_timer(timer_id_t timer_id,
+                                                 int32_t msec)
+{
+    return reschedule_timer(timer_id, int64_t(msec) * 1000, false);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool basic_timer_mgr<Queue, Clock, Lock>::reset_timer(
+    timer_id_t timer_id, std::chrono::microseconds delay)
+{
+    return reschedule_timer(timer_id, delay.count(), false);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::postpone_timer(timer_id_t timer_id,
+                                                    int32_t msec)
+{
+    return reschedule_timer(timer_id, int64_t(msec) * 1000, true);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool basic_timer_mgr<Queue, Clock, Lock>::postpone_timer(
+    timer_id_t timer_id, std::chrono::microseconds delta)
+{
+    return reschedule_timer(timer_id, delta.count(), true);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::reschedule_timer(timer_id_t timer_id,
+                                                      int64_t usec,
+                                                      bool postpone)
+{
+    auto timer = acquire_timer(timer_id);
+    if (timer == nullptr)
+    {
+        return false;
+    }
+
+    if (timer->canceled())
+    {
+        release_timer(timer);
+        return false;
+    }
+
+    // a deadline changed before the last fire is done re-arms the timer.
+    auto old = timer->deadline.load();
+    auto deadline = old;
+    do
+    {
+        if (old == timer_t::finished)
+        {
+            release_timer(timer);
+            return false; // released instead of re-armed.
+        }
+
+        deadline = postpone ? old + usec : schedule_now() + usec;
+    } while (!timer->deadline.compare_exchange_weak(old, deadline));
+
+    // a later deadline is lazy: the queued one fires first and
+    // process_expired_timers re-arms it without running the callback.
+    if (deadline < old)
+    {
+        if (options_.async_submit)
+        {
+            // the schedule thread re-buckets it and drops our reference.
+            if (!timer->reset_pending.exchange(true))
+            {
+                submits_.push(&timer->reset_cmd);
+                if (deadline < wakeup_time_.load())
+                {
+                    std::lock_guard<Lock> guard(schedule_mtx_);
+                    notify_schedule();
+                }
+
+                return true;
+            }
+        }
+        else
+        {
+            auto lock = lock_schedule();
+            if (timer->queued)
+            {
+                queue_.erase(timer);
+                count_pending(-1);
+                setup_timer(timer);
+            }
+        }
+    }
+
+    release_timer(timer);
+    return true;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_t*
+basic_timer_mgr<Queue, Clock, Lock>::acquire_timer(timer_id_t timer_id)
+{
+    auto timer = pool_.find(timer_id);
+    if (timer == nullptr)
+    {
+        return nullptr;
+    }
+
+    // a freed timer is never retained again.
+    auto refs = timer->refs.load(std::memory_order_acquire);
+    do
+    {
+        if (refs == 0)
+        {
+            return nullptr;
+        }
+    } while (!timer->refs.compare_exchange_weak(refs, refs + 1,
+                                                std::memory_order_acq_rel));
+
+    // the slot may be reused by another timer.
+    auto tag = timer->tag.load(std::memory_order_acquire);
+    auto gen = static_cast<uint32_t>(timer_id >> timer_pool::slot_bits);
+    if (((tag >> 2) & timer_pool::gen_mask) != gen)
+    {
+        release_timer(timer);
+        return nullptr;
+    }
+
+    return timer;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::unschedule_timer(timer_t* timer)
+{
+    // an expired timer is released by process_expired_timers.
+    if (!timer->queued)
+    {
+        return false;
+    }
+
+    queue_.erase(timer);
+    count_pending(-1);
+    timer->queued = false;
+    return true;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_stats basic_timer_mgr<Queue, Clock, Lock>::stats() const
+{
+    timer_stats result;
+    result.wakeups = wakeups_.load(std::memory_order_relaxed);
+    result.batches = batches_.load(std::memory_order_relaxed);
+    result.batched_events = batched_events_.load(std::memory_order_relaxed);
+    result.max_batch = max_batch_.load(std::memory_order_relaxed);
+    result.pool_capacity = pool_.capacity();
+    result.queued_callbacks = queued_callbacks_.load(std::memory_order_relaxed);
+    result.dropped_callbacks =
+        dropped_callbacks_.load(std::memory_order_relaxed);
+    result.inline_callbacks =
+        inline_callbacks_.load(std::memory_order_relaxed);
+#ifndef UTILITY_TIMER_NO_STATS
+    result.elapsed_usec = static_cast<uint64_t>(clock_.now() - created_);
+    result.pending_timers = pending_timers_.load(std::memory_order_relaxed);
+    lateness_.snapshot(result.lateness);
+    queue_delay_.snapshot(result.queue_delay);
+    run_time_.snapshot(result.run_time);
+#endif
+    return result;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::shutdown(
+    timer_drain drain, std::chrono::steady_clock::time_point deadline)
+{
+    if (closed_.exchange(true))
+    {
+        return 0;
+    }
+
+    {
+        std::lock_guard<Lock> guard(schedule_mtx_);
+        discard_.store(drain == timer_drain::discard);
+        stop_.store(true);
+        notify_schedule();
+    }
+    {
+        // the schedule thread blocked by a full executor queue.
+        std::lock_guard<std::mutex> guard(overload_mtx_);
+        overload_cv_.notify_all();
+    }
+    if (schedule_thd_.joinable())
+    {
+        schedule_thd_.join();
+    }
+
+    // the commands pushed before, then the timers due by now.
+    drain_submits();
+
+    size_t dropped = 0;
+    auto now = schedule_now();
+    if (drain == timer_drain::run)
+    {
+        poll_expired_timers(now);
+    }
+    else
+    {
+        timer_bucket timers;
+        get_expired_timers(now, timers);
+        while (auto timer = timers.pop_front())
+        {
+            dropped += timer->canceled() ? 0 : 1;
+            release_timer(timer);
+        }
+    }
+
+    if (own_executor_)
+    {
+        dropped += own_executor_->shutdown(drain, deadline);
+    }
+
+    for (auto& thread : lane_threads_)
+    {
+        if (thread)
+        {
+            dropped += thread->shutdown(drain, deadline);
+        }
+    }
+
+    return dropped;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::count_pending(int64_t delta)
+{
+#ifndef UTILITY_TIMER_NO_STATS
+    // the writers are serialized by lock_schedule.
+    pending_timers_.store(
+        pending_timers_.load(std::memory_order_relaxed) + delta,
+        std::memory_order_relaxed);
+#else
+    (void)delta;
+#endif
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline int32_t basic_timer_mgr<Queue, Clock, Lock>::next_timeout()
+{
+    assert(options_.manual_drive);
+    drain_submits();
+
+    auto expires = get_min_expired_time();
+    if (expires == std::numeric_limits<int64_t>::max() || paused())
+    {
+        return -1;
+    }
+
+    auto delta = expires - schedule_now();
+    if (delta <= 0)
+    {
+        return 0;
+    }
+
+    // round up, the poller never returns before the deadline.
+    return static_cast<int32_t>(std::min<int64_t>(
+        (delta + 999) / 1000, std::numeric_limits<int32_t>::max()));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::advance()
+{
+    return advance(clock_.now());
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::advance(int64_t now)
+{
+    assert(options_.manual_drive);
+    drain_submits();
+    if (paused())
+    {
+        return 0;
+    }
+
+    return poll_expired_timers(now - offset_.load());
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::advance(
+    std::chrono::microseconds delta)
+{
+    assert(options_.manual_drive);
+    if (paused())
+    {
+        clock_.set(clock_.now() + delta.count());
+        return 0;
+    }
+
+    size_t fired = 0;
+    auto offset = offset_.load();
+    auto end = schedule_now() + delta.count();
+    while (!paused())
+    {
+        drain_submits();
+
+        // the lower bound of wheel is refined by every step.
+        auto now = std::max(std::min(get_min_expired_time(), end),
+                            schedule_now());
+        clock_.set(now + offset);
+        fired += poll_expired_timers(now);
+
+        drain_submits();
+        if (now >= end && get_min_expired_time() > end)
+        {
+            break;
+        }
+    }
+
+    return fired;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool basic_timer_mgr<Queue, Clock, Lock>::pause()
+{
+    std::lock_guard<Lock> guard(schedule_mtx_);
+    if (paused())
+    {
+        return false;
+    }
+
+    frozen_.store(clock_.now() - offset_.load());
+    notify_schedule();
+    return true;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline bool basic_timer_mgr<Queue, Clock, Lock>::resume()
+{
+    std::lock_guard<Lock> guard(schedule_mtx_);
+    auto frozen = frozen_.load();
+    if (frozen == not_paused)
+    {
+        return false;
+    }
+
+    offset_.store(clock_.now() - frozen);
+    frozen_.store(not_paused);
+    notify_schedule();
+    return true;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t
+basic_timer_mgr<Queue, Clock, Lock>::setup_timer(
+    const timer_spec& spec, timer_callback cb,
+    std::unique_ptr<timer_persist> persist)
+{
+    if (closed_.load(std::memory_order_relaxed))
+    {
+        return -1; // shut down.
+    }
+
+    if (!valid_spec(spec))
+    {
+        return -1;
+    }
+
+    auto timer = pool_.alloc();
+    if (timer == nullptr)
+    {
+        return -1; // too many timers.
+    }
+
+    auto timer_id = timer->timer_id;
+    init_timer(timer, spec, std::move(cb), schedule_now());
+    timer->persist = std::move(persist);
+
+    if (options_.async_submit)
+    {
+        submit(timer);
+        return timer_id;
+    }
+
+    {
+        std::lock_guard<Lock> guard(schedule_mtx_);
+        setup_timer(timer);
+    }
+
+    return timer_id;
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void
+basic_timer_mgr<Queue, Clock, Lock>::init_timer(timer_t* timer,
+                                                const timer_spec& spec,
+                                                timer_callback cb,
+                                                int64_t now)
+{
+    timer->repeat.store(spec.repeat > 0 ? spec.repeat : timer_spec::forever,
+                        std::memory_order_relaxed);
+    timer->catch_up = spec.catch_up;
+    timer->lane = spec.lane;
+    timer->label = spec.label;
+    timer->missed.store(0, std::memory_order_relaxed);
+    timer->interval = spec.interval.count();
+    timer->slack = spec.slack.count();
+    timer->timer_cb = std::move(cb);
+    timer->deadline.store(now + timer->interval);
+    timer->expires = calc_expired_time(timer->deadline.load(), timer->slack);
+#ifdef UTILITY_TIMER_TRACE
+    trace(timer_trace_point::create, timer, now, timer->deadline.load());
+#endif
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t
+basic_timer_mgr<Queue, Clock, Lock>::create_timers(const timer_spec* specs,
+                                                   timer_callback* cbs,
+                                                   size_t count,
+                                                   timer_id_t* ids)
+{
+    if (closed_.load(std::memory_order_relaxed))
+    {
+        std::fill(ids, ids + count, timer_id_t(-1)); // shut down.
+        return 0;
+    }
+
+    // allocate all timers up front.
+    std::vector<timer_t*> timers;
+    timers.reserve(count);
+
+    auto now = schedule_now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!valid_spec(specs[i]))
+        {
+            ids[i] = -1;
+            continue;
+        }
+
+        auto timer = pool_.alloc();
+        if (timer == nullptr)
+        {
+            ids[i] = -1; // too many timers.
+            continue;
+        }
+
+        ids[i] = timer->timer_id;
+        init_timer(timer, specs[i], std::move(cbs[i]), now);
+        timers.push_back(timer);
+    }
+
+    return setup_timers(timers);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::setup_timers(
+    const std::vector<timer_t*>& timers)
+{
+    if (timers.empty())
+    {
+        return 0;
+    }
+
+    // only the earliest one wakes up the scheduler.
+    auto expires = std::numeric_limits<int64_t>::max();
+    for (auto timer : timers)
+    {
+        expires = std::min(expires, timer->expires);
+    }
+
+    if (options_.async_submit)
+    {
+        for (size_t i = 0; i + 1 < timers.size(); ++i)
+        {
+            timers[i]->submit_cmd.mpsc_next.store(&timers[i + 1]->submit_cmd,
+                                                  std::memory_order_relaxed);
+        }
+
+        submits_.push(&timers.front()->submit_cmd, &timers.back()->submit_cmd);
+        if (expires < wakeup_time_.load())
+        {
+            std::lock_guard<Lock> guard(schedule_mtx_);
+            notify_schedule();
+        }
+
+        return timers.size();
+    }
+
+    {
+        std::lock_guard<Lock> guard(schedule_mtx_);
+        for (auto timer : timers)
+        {
+            queue_.push(timer);
+            timer->queued = true;
+        }
+        count_pending(static_cast<int64_t>(timers.size()));
+
+        if (expires < wakeup_time_.load())
+        {
+            wakeup_time_.store(expires);
+            notify_schedule();
+        }
+    }
+
+    return timers.size();
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline timer_id_t
+basic_timer_mgr<Queue, Clock, Lock>::create_persistent_timer(
+    const timer_spec& spec, const timer_registry& registry,
+    const std::string& key, const std::string& data)
+{
+    auto cb = registry.make(key, data);
+    if (!cb)
+    {
+        return -1; // the key is not registered.
+    }
+
+    std::unique_ptr<timer_persist> persist(new timer_persist());
+    persist->key = key;
+    persist->data = data;
+    return setup_timer(spec, std::move(cb), std::move(persist));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline int64_t
+basic_timer_mgr<Queue, Clock, Lock>::save_timers(const std::string& path)
+{
+    std::string content(sizeof(persist_header), '\0');
+    uint64_t count = 0;
+
+    auto wall = wall_now();
+    auto now = schedule_now();
+    auto capacity = static_cast<uint32_t>(pool_.capacity());
+    for (uint32_t slot = 0; slot < capacity; ++slot)
+    {
+        // the reference keeps the timer from being freed meanwhile.
+        auto timer = acquire_timer(pool_.active_id(slot));
+        if (timer == nullptr)
+        {
+            continue;
+        }
+
+        auto repeat = timer->repeat.load(std::memory_order_relaxed);
+        auto persist = timer->persist.get();
+        if (persist != nullptr && repeat != 0 && !timer->canceled())
+        {
+            persist_record record;
+            record.timer_id = timer->timer_id;
+            record.deadline = wall + (timer->deadline.load() - now);
+            record.interval = timer->interval;
+            record.slack = timer->slack;
+            record.repeat = repeat;
+            record.catch_up = static_cast<uint16_t>(timer->catch_up);
+            record.lane = static_cast<uint16_t>(timer->lane);
+            record.key_size = static_cast<uint32_t>(persist->key.size());
+            record.data_size = static_cast<uint32_t>(persist->data.size());
+
+            content.append(reinterpret_cast<const char*>(&record),
+                           sizeof(record));
+            content.append(persist->key);
+            content.append(persist->data);
+            ++count;
+        }
+
+        release_timer(timer);
+    }
+
+    persist_header header;
+    header.magic = persist_header::magic_value;
+    header.version = persist_header::version_value;
+    header.byte_order = persist_header::byte_order_value;
+    header.reserved = 0;
+    header.count = count;
+    std::memcpy(&content[0], &header, sizeof(header));
+
+    if (!write_file(path, content))
+    {
+        return -1;
+    }
+
+    return static_cast<int64_t>(count);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline int64_t basic_timer_mgr<Queue, Clock, Lock>::restore_timers(
+    const std::string& path, const timer_registry& registry,
+    std::map<timer_id_t, timer_id_t>* ids)
+{
+    std::string content;
+    persist_header header;
+    if (!read_file(path, content) || content.size() < sizeof(header))
+    {
+        return -1;
+    }
+
+    std::memcpy(&header, content.data(), sizeof(header));
+    if (header.magic != persist_header::magic_value ||
+        header.version != persist_header::version_value ||
+        header.byte_order != persist_header::byte_order_value)
+    {
+        return -1;
+    }
+
+    // validate all records before any timer is created.
+    std::vector<size_t> offsets;
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.count; ++i)
+    {
+        persist_record record;
+        if (content.size() - offset < sizeof(record))
+        {
+            return -1;
+        }
+
+        std::memcpy(&record, content.data() + offset, sizeof(record));
+        auto size = sizeof(record) + record.key_size + record.data_size;
+        if (content.size() - offset < size ||
+            record.catch_up > static_cast<uint16_t>(timer_catch_up::skip) ||
+            record.lane >= timer_lanes ||
+            (record.interval <= 0 && record.repeat != 1))
+        {
+            return -1;
+        }
+
+        offsets.push_back(offset);
+        offset += size;
+    }
+
+    if (closed_.load(std::memory_order_relaxed))
+    {
+        return 0; // shut down.
+    }
+
+    std::vector<timer_t*> timers;
+    timers.reserve(offsets.size());
+
+    auto wall = wall_now();
+    auto now = schedule_now();
+    for (auto at : offsets)
+    {
+        persist_record record;
+        std::memcpy(&record, content.data() + at, sizeof(record));
+
+        std::unique_ptr<timer_persist> persist(new timer_persist());
+        auto key = content.data() + at + sizeof(record);
+        persist->key.assign(key, record.key_size);
+        persist->data.assign(key + record.key_size, record.data_size);
+
+        auto cb = registry.make(persist->key, persist->data);
+        if (!cb)
+        {
+            continue; // the key is not registered.
+        }
+
+        auto timer = pool_.alloc();
+        if (timer == nullptr)
+        {
+            break; // too many timers.
+        }
+
+        timer_spec spec;
+        spec.interval = std::chrono::microseconds(record.interval);
+        spec.repeat = record.repeat;
+        spec.catch_up = static_cast<timer_catch_up>(record.catch_up);
+        spec.slack = std::chrono::microseconds(record.slack);
+        spec.lane = static_cast<timer_lane>(record.lane);
+        init_timer(timer, spec, std::move(cb), now);
+
+        // a deadline passed while saved is due at once.
+        auto deadline = now + (record.deadline - wall);
+        timer->deadline.store(deadline);
+        timer->expires = calc_expired_time(deadline, timer->slack);
+        timer->persist = std::move(persist);
+        timers.push_back(timer);
+
+        if (ids != nullptr)
+        {
+            (*ids)[record.timer_id] = timer->timer_id;
+        }
+    }
+
+    return static_cast<int64_t>(setup_timers(timers));
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::setup_timer(timer_t* timer)
+{
+    timer->expires = calc_expired_time(timer->deadline.load(), timer->slack);
+    queue_.push(timer);
+    count_pending(1);
+    timer->queued = true;
+
+    if (timer->expires < wakeup_time_.load())
+    {
+        // the new timer is earlier than the sleeping one.
+        wakeup_time_.store(timer->expires);
+        notify_schedule();
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::release_timer(timer_t* timer)
+{
+    if (timer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        pool_.free(timer);
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline std::unique_lock<Lock>
+basic_timer_mgr<Queue, Clock, Lock>::lock_schedule()
+{
+    // async_submit mode: only the schedule thread touch the queue.
+    if (options_.async_submit)
+    {
+        return std::unique_lock<Lock>(schedule_mtx_, std::defer_lock);
+    }
+
+    return std::unique_lock<Lock>(schedule_mtx_);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::submit(timer_t* timer)
+{
+    auto expires = timer->expires;
+    submits_.push(&timer->submit_cmd);
+
+    // wake up the schedule thread only for a earlier timer, the lock
+    // orders the notify after the schedule thread begins waiting.
+    if (expires < wakeup_time_.load())
+    {
+        std::lock_guard<Lock> guard(schedule_mtx_);
+        notify_schedule();
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::drain_submits()
+{
+    cancel_backlog_.store(0, std::memory_order_relaxed);
+    while (!submits_.empty())
+    {
+        auto node = submits_.pop();
+        if (node == nullptr)
+        {
+            // a producer is in the middle of push.
+            std::this_thread::yield();
+            continue;
+        }
+
+        auto cmd = static_cast<timer_cmd*>(node);
+        auto timer = cmd->timer;
+        if (cmd == &timer->cancel_cmd)
+        {
+            if (unschedule_timer(timer))
+            {
+                release_timer(timer);
+            }
+
+            release_timer(timer); // the reference of cancel_timer.
+            continue;
+        }
+
+        if (cmd == &timer->reset_cmd)
+        {
+            // read the latest deadline after the flag is cleared.
+            timer->reset_pending.store(false);
+            if (timer->queued)
+            {
+                queue_.erase(timer);
+                count_pending(-1);
+                setup_timer(timer);
+            }
+
+            release_timer(timer); // the reference of reset_timer.
+            continue;
+        }
+
+        if (timer->canceled())
+        {
+            release_timer(timer); // canceled before scheduled.
+            continue;
+        }
+
+        setup_timer(timer);
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::schedule()
+{
+    apply_thread_options(options_.schedule_thread, "timer-schedule");
+    while (!stop_.load())
+    {
+        drain_submits();
+        poll_expired_timers(schedule_now());
+
+        wait_expired_time();
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::run_timer(timer_t* timer,
+                                                           int64_t posted)
+{
+#ifndef UTILITY_TIMER_NO_STATS
+    auto start = clock_.now();
+    queue_delay_.record(static_cast<uint64_t>(std::max<int64_t>(
+        start - posted, 0)));
+#else
+    (void)posted;
+#endif
+
+    auto more = false;
+    do
+    {
+        // block: the schedule thread waits for the depth below the limit.
+        auto depth = queued_callbacks_.fetch_sub(1) - 1;
+        if (overload_waiting_.load() &&
+            depth < options_.max_queued_callbacks)
+        {
+            std::lock_guard<std::mutex> guard(overload_mtx_);
+            overload_cv_.notify_one();
+        }
 
-    // singleton interface.
-    static timer_iface& get();
-};
+        // the timer may be canceled after expired.
+        if (!timer->canceled())
+        {
+#ifdef UTILITY_TIMER_TRACE
+            trace(timer_trace_point::dispatch_start, timer, schedule_now(),
+                  0);
+            timer->timer_cb(timer->missed.exchange(0));
+            trace(timer_trace_point::dispatch_end, timer, schedule_now(), 0);
+#else
+            timer->timer_cb(timer->missed.exchange(0));
+#endif
+        }
 
-////////////////////////////////////////////////////////////////////////
+#ifndef UTILITY_TIMER_NO_STATS
+        auto end = clock_.now();
+        run_time_.record(static_cast<uint64_t>(end - start));
+        start = end;
+#endif
 
+        // ordered_callbacks: run the events fired while running.
+        more = options_.ordered_callbacks &&
+            timer->pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
 
-// timer_iface implement.
-namespace detail
-{
+        release_timer(timer);
+    } while (more);
+}
 
-struct timer_t
+#ifdef UTILITY_TIMER_TRACE
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::trace(
+    timer_trace_point point, const timer_t* timer, int64_t time,
+    int64_t deadline) const
 {
-    int32_t        msec{ 0 };
-    int64_t        expires{ 0 };
-    int32_t        timer_id{ 0 };
-    int32_t        repeat{ 0 };
-    timer_event_t  timer_cb{ nullptr };
-
-    using ptr = std::shared_ptr<struct timer_t>;
-    using wptr = std::weak_ptr<struct timer_t>;
-};
+    if (options_.trace_sink == nullptr)
+    {
+        return;
+    }
 
-// the timer(weak) bucket expired on same time.
-using timer_bucket = std::list<timer_t::wptr>;
-// the expired timer buckets managed by key：expired time
-using expired_timer_buckets = std::map<int64_t, timer_bucket>;
-// the timer(strong) object set managed by key：timer id
-using id_timers = std::unordered_map<int32_t, timer_t::ptr>;
+    timer_trace_event event;
+    event.point = point;
+    event.lane = timer->lane;
+    event.timer_id = timer->timer_id;
+    event.label = timer->label;
+    event.time = time;
+    event.deadline = deadline;
+    options_.trace_sink->record(event);
+}
+#endif
 
-// steady clock tick count(milliseconds) on startup.
-static int64_t tick_count()
+template <typename Queue, typename Clock, typename Lock>
+inline void
+basic_timer_mgr<Queue, Clock, Lock>::run_task(void* owner, void* timer,
+                                              int64_t posted)
 {
-    using namespace std::chrono;
-    auto now_ms = duration_cast<milliseconds>(
-        steady_clock::now().time_since_epoch()).count();
-    return now_ms;
+    static_cast<basic_timer_mgr*>(owner)->run_timer(
+        static_cast<timer_t*>(timer), posted);
 }
 
-class timer_mgr : public timer_iface
+template <typename Queue, typename Clock, typename Lock>
+inline size_t
+basic_timer_mgr<Queue, Clock, Lock>::poll_expired_timers(int64_t now)
 {
-public:
-    int32_t create_timer(int32_t msec, timer_event_t cb) override;
-    int32_t create_repeat_timer(int32_t msec, int32_t repeat,
-                                timer_event_t cb) override;
+    if (now < get_min_expired_time())
+    {
+        return 0;
+    }
 
-    bool cancel_timer(int32_t timer_id) override;
+    timer_bucket timers;
+    get_expired_timers(now, timers);
 
-public:
-    timer_mgr(const timer_mgr&) = delete;
-    timer_mgr& operator=(const timer_mgr&) = delete;
+    return process_expired_timers(now, timers);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void
+basic_timer_mgr<Queue, Clock, Lock>::get_expired_timers(int64_t now,
+                                                        timer_bucket& timers)
+{
+    auto lock = lock_schedule();
+    queue_.pop_expired(now, timers);
 
-    timer_mgr() noexcept
+    int64_t popped = 0;
+    for (auto timer = timers.front(); timer; timer = timers.next(timer))
     {
-        stop_.store(false);
-        schedule_thd_ = std::thread(&timer_mgr::schedule, this);
-        event_thd_ = std::thread(&timer_mgr::run_timer_event, this);
+        timer->queued = false;
+        ++popped;
     }
+    count_pending(-popped);
+}
 
-    virtual ~timer_mgr() noexcept
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::process_expired_timers(
+    int64_t now, timer_bucket& timers)
+{
+    if (timers.empty())
     {
-        stop_.store(true);
-        schedule_thd_.join();
-        event_cv_.notify_one();
-        event_thd_.join();
+        return 0;
     }
 
-private:
-    int32_t setup_timer(int32_t msec, int32_t repeat, timer_event_t cb);
-    void setup_timer(timer_t::ptr& timer);
-
-    // timer schedule task thread.
-    void schedule();
-
-    // run timer callback event in another thread.
-    void run_timer_event();
+    // the callbacks run inline or posted by a full queue before.
+    auto inlined = inline_callbacks_.load(std::memory_order_relaxed);
+    size_t fired = 0;
+#ifndef UTILITY_TIMER_NO_STATS
+    // now may be the virtual time of advance(now).
+    auto posted = clock_.now();
+#else
+    int64_t posted = 0;
+#endif
 
-    int32_t alloc_timerid();
+    // pick timers callback.
+    for (auto timer = timers.front(); timer; timer = timers.next(timer))
+    {
+        if (!timer->canceled())
+        {
+            // a timer postponed by reset_timer is re-armed without fire.
+            auto old = timer->deadline.load();
+            auto deadline = old;
+            auto repeat = timer->repeat.load(std::memory_order_relaxed);
+            if (repeat != 0 &&
+                calc_expired_time(deadline, timer->slack) <= now)
+            {
+                // the due ticks, all but the last one are missed.
+                int64_t due = 1;
+                if (timer->interval > 0)
+                {
+                    due = (now - deadline) / timer->interval + 1;
+                }
 
-    // calc timer expired time.
-    int64_t calc_expired_time(int32_t msec);
+                auto catch_up = timer->catch_up;
+                if (repeat > 0 && catch_up != timer_catch_up::skip)
+                {
+                    due = std::min<int64_t>(due, repeat);
+                }
 
-    void get_expired_timers(expired_timer_buckets& timers);
-    void process_expired_timers(expired_timer_buckets& timers);
+                auto events = catch_up == timer_catch_up::fire_all ? due : 1;
+                for (int64_t i = 0; i < events; ++i)
+                {
+#ifndef UTILITY_TIMER_NO_STATS
+                    // the lag of this event from its tick.
+                    auto tick = deadline + (due - events + i) *
+                        timer->interval;
+                    lateness_.record(static_cast<uint64_t>(
+                        std::max<int64_t>(now - tick, 0)));
+#endif
+#ifdef UTILITY_TIMER_TRACE
+                    trace(timer_trace_point::fire, timer, now, deadline +
+                          (due - events + i) * timer->interval);
+#endif
+                    if (!admit_callback(timer, posted))
+                    {
+                        continue;
+                    }
 
-    int64_t get_min_expired_time();
+                    timer->refs.fetch_add(1, std::memory_order_relaxed);
+                    if (!options_.ordered_callbacks ||
+                        timer->pending.fetch_add(
+                            1, std::memory_order_acq_rel) == 0)
+                    {
+                        expired_tasks_[static_cast<size_t>(timer->lane)]
+                            .emplace_back(&run_task, this, timer, posted);
+                    }
+                }
 
-    // sleep for a while.
-    void sleep_ms(int32_t msec);
+                if (catch_up != timer_catch_up::fire_all && due > 1)
+                {
+                    auto missed = std::min<int64_t>(
+                        due - 1, std::numeric_limits<uint32_t>::max());
+                    timer->missed.fetch_add(static_cast<uint32_t>(missed));
+                }
 
-private:
-    std::atomic_bool stop_{ true };
+                if (repeat > 0)
+                {
+                    repeat -= static_cast<int32_t>(
+                        catch_up == timer_catch_up::skip ? 1 : due);
+                }
 
-    // timer schedule thread.
-    std::mutex schedule_mtx_;
-    std::thread schedule_thd_;
+                // accumulate delta time, keep aligned to the first deadline.
+                deadline += due * timer->interval;
+            }
 
-    // key: expired time.
-    expired_timer_buckets bucket_timers_;
-    // key: timer id.
-    id_timers id_timers_;
+            // keep the deadline of a concurrent reset_timer, it gets one
+            // more fire if it raced with the last one, which is finished
+            // otherwise.
+            auto next = repeat == 0 ? timer_t::finished : deadline;
+            if (!timer->deadline.compare_exchange_strong(old, next) &&
+                repeat == 0)
+            {
+                repeat = 1;
+            }
+            timer->repeat.store(repeat, std::memory_order_relaxed);
+        }
+    }
 
-    // timer id alloced start number.
-    std::atomic_int id_{ 0 };
+    fired += post_callbacks();
+    fired += static_cast<size_t>(
+        inline_callbacks_.load(std::memory_order_relaxed) - inlined);
 
-    std::mutex event_mtx_;
-    std::thread event_thd_;
-    std::condition_variable event_cv_;
-    std::list<timer_event_t> timer_events_;
+    {
+        auto lock = lock_schedule();
+        while (auto timer = timers.pop_front())
+        {
+            // timer is canceled by user or finished.
+            if (timer->canceled() ||
+                timer->repeat.load(std::memory_order_relaxed) == 0)
+            {
+                release_timer(timer);
+                continue;
+            }
 
-    // use condition_variable to simulate sleep_for
-    // because the sleep_for is not reliable on windows.
-    std::mutex sleep_mtx_;
-    std::condition_variable sleep_cv_;
-};
+            setup_timer(timer);
+        }
+    }
 
-inline int64_t timer_mgr::calc_expired_time(int32_t msec)
-{
-    // timeout = (msec + now_time)/accuracy_ * accuracy_;
-    //return (now_msec_time() + msec) / accuracy_ * accuracy_;
-    return tick_count() + msec;
+    return fired;
 }
 
-inline int32_t timer_mgr::create_timer(int32_t msec, timer_event_t cb)
+template <typename Queue, typename Clock, typename Lock>
+inline bool
+basic_timer_mgr<Queue, Clock, Lock>::admit_callback(timer_t* timer,
+                                                    int64_t posted)
 {
-    return setup_timer(msec, 1, std::move(cb));
-}
+    auto limit = options_.max_queued_callbacks;
+    if (limit == 0 || queued_callbacks_.load() < limit)
+    {
+        queued_callbacks_.fetch_add(1);
+        return true;
+    }
 
-inline int32_t timer_mgr::create_repeat_timer(int32_t msec, int32_t repeat,
-                                              timer_event_t cb)
-{
-    assert(repeat > 0);
-    return setup_timer(msec, repeat, std::move(cb));
-}
+    // only the schedule thread writes the counters.
+    switch (options_.overload)
+    {
+    case timer_overload::drop_newest:
+        break;
 
-inline bool timer_mgr::cancel_timer(int32_t timer_id)
-{
-    bool result = false;
+    case timer_overload::run_inline:
+        // a ordered timer can't overtake its callbacks queued, and the
+        // catch-up of a discarded timer is not run.
+        if (discard_.load() || (options_.ordered_callbacks &&
+            timer->pending.load(std::memory_order_acquire) != 0))
+        {
+            break;
+        }
+
+        queued_callbacks_.fetch_add(1);
+        timer->refs.fetch_add(1, std::memory_order_relaxed);
+        if (options_.ordered_callbacks)
+        {
+            timer->pending.fetch_add(1, std::memory_order_acq_rel);
+        }
 
+        inline_callbacks_.store(
+            inline_callbacks_.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        run_timer(timer, posted);
+        return false;
+
+    case timer_overload::block:
     {
-        // just delete the shared_ptr timer_obj,
-        // then the weak_ptr lock() will return nullptr.
-        std::lock_guard<std::mutex> guard(schedule_mtx_);
-        result = id_timers_.erase(timer_id) == 1U;
+        // the callbacks collected are run meanwhile.
+        flushed_callbacks_ += flush_callbacks();
+
+        std::unique_lock<std::mutex> lock(overload_mtx_);
+        overload_waiting_.store(true);
+        overload_cv_.wait(lock, [this, limit]()
+        {
+            return queued_callbacks_.load() < limit || stop_.load();
+        });
+        overload_waiting_.store(false);
+        if (discard_.load())
+        {
+            break;
+        }
+
+        queued_callbacks_.fetch_add(1);
+        return true;
+    }
     }
 
-    return result;
+    dropped_callbacks_.store(
+        dropped_callbacks_.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    return false;
 }
 
-inline int32_t timer_mgr::setup_timer(int32_t msec, int32_t repeat,
-                                      timer_event_t cb)
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::post_callbacks()
 {
-    assert(repeat > 0);
-
-    auto timer_id = alloc_timerid();
-
-    auto timer = std::make_shared<timer_t>();
-    timer->timer_id = timer_id;
-    timer->repeat = repeat;
-    timer->msec = msec;
-    timer->timer_cb = std::move(cb);
-    timer->expires = calc_expired_time(msec);
+    auto count = flushed_callbacks_ + flush_callbacks();
+    flushed_callbacks_ = 0;
+    if (count == 0)
+    {
+        return 0;
+    }
 
+    // only the schedule thread writes the counters.
+    batches_.store(batches_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    batched_events_.store(
+        batched_events_.load(std::memory_order_relaxed) + count,
+        std::memory_order_relaxed);
+    if (count > max_batch_.load(std::memory_order_relaxed))
     {
-        std::lock_guard<std::mutex> guard(schedule_mtx_);
-        setup_timer(timer);
+        max_batch_.store(count, std::memory_order_relaxed);
     }
 
-    return timer_id;
+    return count;
 }
 
-inline void timer_mgr::setup_timer(timer_t::ptr& timer)
+template <typename Queue, typename Clock, typename Lock>
+inline size_t basic_timer_mgr<Queue, Clock, Lock>::flush_callbacks()
 {
-    id_timers_[timer->timer_id] = timer;
-    bucket_timers_[timer->expires].emplace_back(timer);
+    size_t count = 0;
+    for (size_t i = 0; i < timer_lanes; ++i)
+    {
+        auto& tasks = expired_tasks_[i];
+        if (!tasks.empty())
+        {
+            count += tasks.size();
+            lane_executors_[i]->post(static_cast<timer_lane>(i),
+                                     tasks.data(), tasks.size());
+            tasks.clear();
+        }
+    }
+
+    return count;
 }
 
-inline int32_t timer_mgr::alloc_timerid()
+template <typename Queue, typename Clock, typename Lock>
+inline int64_t basic_timer_mgr<Queue, Clock, Lock>::get_min_expired_time()
 {
-    return id_.fetch_add(1);
+    auto lock = lock_schedule();
+    return queue_.min_expires();
 }
 
-inline void timer_mgr::schedule()
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::wait_expired_time()
 {
-    while (!stop_.load())
+    std::unique_lock<Lock> lock(schedule_mtx_);
+    auto expires = queue_.min_expires();
+    if (stop_.load() || expires <= schedule_now())
     {
-        if (tick_count() >= get_min_expired_time())
-        {
-            expired_timer_buckets timers;
-            get_expired_timers(timers);
-
-            process_expired_timers(timers);
-        }
+        return;
+    }
 
-        sleep_ms(1);
+    // nothing fires until resume().
+    if (paused())
+    {
+        expires = std::numeric_limits<int64_t>::max();
     }
-}
 
-inline void timer_mgr::run_timer_event()
-{
-    while (!stop_.load())
+    // During on Windows testing, it was found that there was
+    // an error of approximately 15 milliseconds.
+    // sleep_for is not reliable on Windows.
+    wakeup_time_.store(expires);
+    if (!submits_.empty())
     {
-        decltype(timer_events_) timers;
+        // a command is pushed before the wakeup time is visible.
+        wakeup_time_.store(std::numeric_limits<int64_t>::min());
+        return;
+    }
 
+    if (expires == std::numeric_limits<int64_t>::max())
+    {
+        sleep_schedule(lock, expires);
+    }
+    else
+    {
+        auto sleep_time = expires - options_.spin_usec;
+        if (sleep_time > schedule_now())
         {
-            std::unique_lock<std::mutex> lock(event_mtx_);
-            event_cv_.wait(lock, [this]()
-            {
-                return stop_.load() || !timer_events_.empty();
-            });
+            sleep_schedule(lock, sleep_time);
+        }
 
-            if (stop_.load())
+        // high resolution mode: spin the last stretch without the lock,
+        // a earlier timer lowers the wakeup time or pushes a command.
+        if (options_.spin_usec > 0 && schedule_now() >= sleep_time)
+        {
+            lock.unlock();
+            while (!stop_.load() && submits_.empty() &&
+                   schedule_now() < wakeup_time_.load())
             {
-                // timer is stoped, don't run timer callback.
-                return;
             }
-
-            timers = std::move(timer_events_);
         }
+    }
 
-        for (auto& cb : timers)
-        {
-            cb();
-        }
+    wakeup_time_.store(std::numeric_limits<int64_t>::min());
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::sleep_schedule(
+    std::unique_lock<Lock>& lock, int64_t expires)
+{
+    // the sleep is on the steady clock whatever the clock policy is.
+    if ((!std::is_same<Clock, tick_clock>::value || offset_.load() != 0) &&
+        expires != std::numeric_limits<int64_t>::max())
+    {
+        expires = tick_count_us() + (expires - schedule_now());
+    }
+
+    if (native_waiter_)
+    {
+        native_waiter_->wait(lock, expires);
+    }
+    else if (expires == std::numeric_limits<int64_t>::max())
+    {
+        schedule_cv_.wait(lock);
+    }
+    else
+    {
+        auto expired_time = std::chrono::steady_clock::time_point(
+            std::chrono::microseconds(expires));
+        schedule_cv_.wait_until(lock, expired_time);
+    }
+}
+
+template <typename Queue, typename Clock, typename Lock>
+inline void basic_timer_mgr<Queue, Clock, Lock>::notify_schedule()
+{
+    if (native_waiter_)
+    {
+        native_waiter_->notify();
+    }
+    else
+    {
+        schedule_cv_.notify_one();
     }
 }
 
-inline void timer_mgr::get_expired_timers(expired_timer_buckets& timers)
+// the timing wheel is the default scheduler queue,
+// define UTILITY_TIMER_MAP_QUEUE or UTILITY_TIMER_HEAP_QUEUE to use
+// the std::map or the heap queue instead.
+using map_timer_mgr = basic_timer_mgr<map_queue>;
+using wheel_timer_mgr = basic_timer_mgr<wheel_queue>;
+using heap_timer_mgr = basic_timer_mgr<heap_queue>;
+// the virtual time of simulations, manual_drive and advance(delta).
+using virtual_timer_mgr = basic_timer_mgr<wheel_queue, virtual_clock>;
+#if defined(UTILITY_TIMER_MAP_QUEUE)
+using timer_mgr = map_timer_mgr;
+#elif defined(UTILITY_TIMER_HEAP_QUEUE)
+using timer_mgr = heap_timer_mgr;
+#else
+using timer_mgr = wheel_timer_mgr;
+#endif
+
+} // namespace detail
+
+// the default timer manager and the one of virtual time, they are the
+// concrete types of next_timeout(), advance(), pause() and resume().
+using timer_mgr = detail::timer_mgr;
+using virtual_timer_mgr = detail::virtual_timer_mgr;
+
+// sharded front-end of timer managers for the thread-per-core design,
+// every shard owns its threads and locks, create_timer goes to the shard
+// of the calling thread and the shard is encoded in the timer id.
+class sharded_timer : public timer_iface
 {
-    std::lock_guard<std::mutex> lock(schedule_mtx_);
-    auto now = tick_count();
+public:
+    using timer_iface::create_timer;
+    using timer_iface::create_repeat_timer;
+
+    static constexpr int shard_shift =
+        detail::timer_pool::slot_bits + detail::timer_pool::gen_bits;
+    static constexpr size_t max_shards = size_t(1) << (63 - shard_shift);
 
-    auto it = bucket_timers_.begin();
-    while (it != bucket_timers_.end())
+    explicit sharded_timer(size_t shards,
+                           const timer_options& options = timer_options())
     {
-        if (it->first > now)
+        assert(shards > 0 && shards <= max_shards);
+        assert(!options.manual_drive); // nothing drives the shards.
+        for (size_t i = 0; i < shards; ++i)
         {
-            break;
+            shards_.emplace_back(new detail::timer_mgr(options));
         }
+    }
 
-        timers[it->first] = std::move(it->second);
-        it = bucket_timers_.erase(it);
+    timer_id_t create_timer(int32_t msec, timer_callback cb) override
+    {
+        auto shard = local_shard();
+        auto id = shards_[shard]->create_timer(msec, std::move(cb));
+        return make_id(shard, id);
     }
-}
 
-inline void timer_mgr::process_expired_timers(expired_timer_buckets& timers)
-{
-    if (timers.empty())
+    timer_id_t create_repeat_timer(int32_t msec, int32_t repeat,
+                                   timer_callback cb) override
     {
-        return;
+        auto shard = local_shard();
+        auto id = shards_[shard]->create_repeat_timer(msec, repeat,
+                                                      std::move(cb));
+        return make_id(shard, id);
     }
 
-    auto now = tick_count();
-    decltype(timer_events_) timers_cb;
+    timer_id_t create_timer(std::chrono::microseconds delay,
+                            timer_callback cb) override
+    {
+        auto shard = local_shard();
+        auto id = shards_[shard]->create_timer(delay, std::move(cb));
+        return make_id(shard, id);
+    }
 
-    // pick timers callback.
-    for (auto& it : timers)
+    timer_id_t create_repeat_timer(std::chrono::microseconds interval,
+                                   int32_t repeat,
+                                   timer_callback cb) override
+    {
+        auto shard = local_shard();
+        auto id = shards_[shard]->create_repeat_timer(interval, repeat,
+                                                      std::move(cb));
+        return make_id(shard, id);
+    }
+
+    timer_id_t create_timer(const timer_spec& spec,
+                            timer_callback cb) override
+    {
+        auto shard = local_shard();
+        auto id = shards_[shard]->create_timer(spec, std::move(cb));
+        return make_id(shard, id);
+    }
+
+    size_t create_timers(const timer_spec* specs, timer_callback* cbs,
+                         size_t count, timer_id_t* ids) override
+    {
+        auto shard = local_shard();
+        auto created = shards_[shard]->create_timers(specs, cbs, count, ids);
+        for (size_t i = 0; i < count; ++i)
+        {
+            ids[i] = make_id(shard, ids[i]);
+        }
+
+        return created;
+    }
+
+    size_t cancel_timers(const timer_id_t* ids, size_t count) override
     {
-        for (auto& weak_timer : it.second)
+        // a batch for every shard.
+        std::vector<timer_id_t> batch;
+        size_t canceled = 0;
+        for (size_t shard = 0; shard < shards_.size(); ++shard)
         {
-            auto timer = weak_timer.lock();
-            if (timer)
+            batch.clear();
+            for (size_t i = 0; i < count; ++i)
             {
-                do
+                if (shard_of(ids[i]) == shards_[shard].get())
                 {
-                    timers_cb.emplace_back(timer->timer_cb);
-                    timer->repeat -= 1;
-                    timer->expires += timer->msec;
+                    batch.push_back(local_id(ids[i]));
+                }
+            }
 
-                    // accumulate delta time.
-                } while (timer->repeat > 0 && timer->expires <= now);
+            if (!batch.empty())
+            {
+                canceled += shards_[shard]->cancel_timers(batch.data(),
+                                                          batch.size());
             }
         }
+
+        return canceled;
     }
 
-    if(!timers_cb.empty())
+    bool reset_timer(timer_id_t timer_id, int32_t msec) override
     {
-        // timer callback will run in another thread.
-        // Avoiding prolonged execution of callbacks that affect timer accuracy.
-        std::lock_guard<std::mutex> guard(event_mtx_);
-        timer_events_.insert(timer_events_.end(),
-                               timers_cb.begin(), timers_cb.end());
+        auto shard = shard_of(timer_id);
+        return shard != nullptr && shard->reset_timer(local_id(timer_id), msec);
+    }
+
+    bool reset_timer(timer_id_t timer_id,
+                     std::chrono::microseconds delay) override
+    {
+        auto shard = shard_of(timer_id);
+        return shard != nullptr &&
+            shard->reset_timer(local_id(timer_id), delay);
+    }
+
+    bool postpone_timer(timer_id_t timer_id, int32_t msec) override
+    {
+        auto shard = shard_of(timer_id);
+        return shard != nullptr &&
+            shard->postpone_timer(local_id(timer_id), msec);
+    }
+
+    bool postpone_timer(timer_id_t timer_id,
+                        std::chrono::microseconds delta) override
+    {
+        auto shard = shard_of(timer_id);
+        return shard != nullptr &&
+            shard->postpone_timer(local_id(timer_id), delta);
+    }
 
-        event_cv_.notify_one();
+    bool cancel_timer(timer_id_t timer_id) override
+    {
+        auto shard = shard_of(timer_id);
+        return shard != nullptr && shard->cancel_timer(local_id(timer_id));
     }
 
+    size_t shutdown(timer_drain drain = timer_drain::discard,
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::time_point::max())
+        override
     {
-        std::lock_guard<std::mutex> guard(schedule_mtx_);
-        for (auto& it : timers)
+        size_t dropped = 0;
+        for (auto& shard : shards_)
         {
-            for (auto& weak_timer : it.second)
-            {
-                auto timer = weak_timer.lock();
-                if (!timer)
-                {
-                    continue; // timer is canceled by user.
-                }
+            dropped += shard->shutdown(drain, deadline);
+        }
 
-                if (timer->repeat <= 0)
-                {
-                    id_timers_.erase(timer->timer_id);
-                    continue;
-                }
+        return dropped;
+    }
 
-                setup_timer(timer);
-            }
+    timer_stats stats() const override
+    {
+        timer_stats result;
+        for (auto& shard : shards_)
+        {
+            auto stats = shard->stats();
+            result.wakeups += stats.wakeups;
+            result.batches += stats.batches;
+            result.batched_events += stats.batched_events;
+            result.max_batch = std::max(result.max_batch, stats.max_batch);
+            result.pool_capacity += stats.pool_capacity;
+            result.queued_callbacks += stats.queued_callbacks;
+            result.dropped_callbacks += stats.dropped_callbacks;
+            result.inline_callbacks += stats.inline_callbacks;
+#ifndef UTILITY_TIMER_NO_STATS
+            result.elapsed_usec = std::max(result.elapsed_usec,
+                                           stats.elapsed_usec);
+            result.pending_timers += stats.pending_timers;
+            result.lateness.merge(stats.lateness);
+            result.queue_delay.merge(stats.queue_delay);
+            result.run_time.merge(stats.run_time);
+#endif
         }
+
+        return result;
     }
-}
 
-inline int64_t timer_mgr::get_min_expired_time()
-{
-    std::lock_guard<std::mutex> guard(schedule_mtx_);
-    if (bucket_timers_.empty())
+    size_t shards() const { return shards_.size(); }
+
+    // bind the calling thread to a shard(e.g. the core it is pinned to),
+    // a unbound thread is assigned round-robin on its first timer.
+    static void bind_thread(size_t shard) { thread_shard() = shard; }
+
+private:
+    static size_t& thread_shard()
     {
-        return std::numeric_limits<int64_t>::max();
+        static std::atomic<size_t> next{ 0 };
+        static thread_local size_t shard = next.fetch_add(1);
+        return shard;
     }
 
-    return bucket_timers_.begin()->first;
-}
+    size_t local_shard() const { return thread_shard() % shards_.size(); }
 
-inline void timer_mgr::sleep_ms(int32_t msec)
-{
-    // During on Windows testing, it was found that there was
-    // an error of approximately 15 milliseconds.
-    // sleep_for is not reliable on Windows.
-    //std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+    static timer_id_t make_id(size_t shard, timer_id_t id)
+    {
+        return id < 0 ? id
+                      : (static_cast<timer_id_t>(shard) << shard_shift) | id;
+    }
+
+    // the shard encoded in the timer id, nullptr if invalid.
+    detail::timer_mgr* shard_of(timer_id_t timer_id) const
+    {
+        if (timer_id < 0)
+        {
+            return nullptr;
+        }
 
-    std::unique_lock<std::mutex> lock(sleep_mtx_);
+        auto shard = static_cast<size_t>(timer_id >> shard_shift);
+        return shard < shards_.size() ? shards_[shard].get() : nullptr;
+    }
 
-    auto expired_time = std::chrono::steady_clock::now();
-    expired_time += std::chrono::milliseconds(msec);
+    static timer_id_t local_id(timer_id_t timer_id)
+    {
+        return timer_id & ((timer_id_t(1) << shard_shift) - 1);
+    }
 
-    sleep_cv_.wait_until(lock, expired_time);
-}
-} // namespace detail
+private:
+    std::vector<std::unique_ptr<detail::timer_mgr>> shards_;
+};
 
 // hide in end of this file.
 inline timer_iface& timer_iface::get()
@@ -404,6 +4576,17 @@ inline timer_iface& timer_iface::get()
     return mgr;
 }
 
+inline std::unique_ptr<timer_iface> timer_iface::create(
+    const timer_options& options)
+{
+    if (options.manual_drive)
+    {
+        return nullptr; // never fired through timer_iface.
+    }
+
+    return std::unique_ptr<timer_iface>(new detail::timer_mgr(options));
+}
+
 } // namespace timer
 } // namespace utility
 
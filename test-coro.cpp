@@ -0,0 +1,113 @@
+﻿#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "cxx-timer-coro.h"
+using namespace utility::timer;
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+// a eager fire-and-forget coroutine of the tests.
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+static detached sleep_twice(timer_iface& timer, std::vector<int64_t>& out,
+                            const detail::virtual_clock& clock)
+{
+    using namespace std::chrono;
+
+    // -1 if the timer is shut down.
+    auto slept = co_await sleep_for(timer, milliseconds(10));
+    out.push_back(slept ? clock.now() : -1);
+    slept = co_await sleep_for(timer, microseconds(2500));
+    out.push_back(slept ? clock.now() : -1);
+}
+
+static detached sleep_timeout(timer_iface& timer, int32_t sleep_msec,
+                              int32_t timeout_msec, int& result)
+{
+    using namespace std::chrono;
+
+    auto slept = co_await with_timeout(
+        timer, sleep_for(timer, milliseconds(sleep_msec)),
+        milliseconds(timeout_msec));
+    result = slept ? 1 : 0;
+}
+
+static detached sleep_on(timer_iface& timer, std::thread::id& id,
+                         std::atomic_bool& done)
+{
+    co_await sleep_for(timer, std::chrono::milliseconds(1));
+    id = std::this_thread::get_id();
+    done.store(true);
+}
+
+TEST_CASE("test timer coroutine sleep_for")
+{
+    timer_options options;
+    options.manual_drive = true;
+    detail::virtual_timer_mgr mgr(options);
+
+    std::vector<int64_t> resumed;
+    sleep_twice(mgr, resumed, mgr.clock());
+    CHECK(resumed.empty());
+
+    CHECK_EQ(mgr.advance(std::chrono::milliseconds(20)), 2U);
+    REQUIRE_EQ(resumed.size(), 2U);
+    CHECK_EQ(resumed[0], 10000);
+    CHECK_EQ(resumed[1], 12500);
+
+    // resumed on the executor thread.
+    std::thread::id id;
+    std::atomic_bool done{ false };
+    detail::timer_mgr timer;
+    sleep_on(timer, id, done);
+    while (!done.load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CHECK_NE(id, std::this_thread::get_id());
+
+    // not suspended on a closed timer.
+    mgr.shutdown();
+    sleep_twice(mgr, resumed, mgr.clock());
+    REQUIRE_EQ(resumed.size(), 4U);
+    CHECK_EQ(resumed[2], -1);
+    CHECK_EQ(resumed[3], -1);
+}
+
+TEST_CASE("test timer coroutine with_timeout")
+{
+    using namespace std::chrono;
+
+    timer_options options;
+    options.manual_drive = true;
+    detail::virtual_timer_mgr mgr(options);
+
+    // completed in time, the timeout timer is canceled.
+    auto completed = -1;
+    sleep_timeout(mgr, 5, 10, completed);
+    CHECK_EQ(mgr.advance(milliseconds(5)), 1U);
+    CHECK_EQ(completed, 1);
+    CHECK_EQ(mgr.advance(milliseconds(10)), 0U);
+
+    // timed out, the sleep still completes later and is dropped.
+    auto timed_out = -1;
+    sleep_timeout(mgr, 50, 10, timed_out);
+    CHECK_EQ(mgr.advance(milliseconds(10)), 1U);
+    CHECK_EQ(timed_out, 0);
+    CHECK_EQ(mgr.advance(milliseconds(40)), 1U);
+    CHECK_EQ(timed_out, 0);
+    CHECK_EQ(mgr.stats().pending_timers, 0U);
+}
@@ -0,0 +1,115 @@
+﻿#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the trace hooks are compiled in by this test only.
+#define UTILITY_TIMER_TRACE
+#include "cxx-timer.h"
+using namespace utility::timer;
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+class trace_recorder : public timer_trace_sink
+{
+public:
+    void record(const timer_trace_event& event) override
+    {
+        std::lock_guard<std::mutex> guard(mtx_);
+        events_.push_back(event);
+    }
+
+    std::vector<timer_trace_event> events()
+    {
+        std::lock_guard<std::mutex> guard(mtx_);
+        return events_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<timer_trace_event> events_;
+};
+
+TEST_CASE("test timer trace")
+{
+    using namespace std::chrono;
+
+    static const char label[] = "heartbeat";
+    trace_recorder recorder;
+    timer_options options;
+    options.manual_drive = true;
+    options.trace_sink = &recorder;
+    detail::virtual_timer_mgr mgr(options);
+
+    auto id = mgr.create_repeat_timer(10, 2, []() {}, label);
+    timer_iface& iface = mgr;
+    iface.create_timer(milliseconds(15), []() {});
+    mgr.advance(milliseconds(25));
+
+    std::string points;
+    int64_t fire = 0;
+    for (auto& event : recorder.events())
+    {
+        if (event.timer_id != id)
+        {
+            CHECK_EQ(event.label, nullptr);
+            continue;
+        }
+
+        CHECK_EQ(event.label, label);
+        CHECK_EQ(event.lane, timer_lane::normal);
+        switch (event.point)
+        {
+        case timer_trace_point::create:
+            points += 'c';
+            CHECK_EQ(event.deadline, 10000);
+            break;
+        case timer_trace_point::fire:
+            points += 'f';
+            CHECK_EQ(event.deadline, fire + 10000);
+            CHECK_GE(event.time, event.deadline);
+            fire = event.deadline;
+            break;
+        case timer_trace_point::dispatch_start:
+            points += 's';
+            CHECK_GE(event.time, fire);
+            break;
+        case timer_trace_point::dispatch_end:
+            points += 'e';
+            break;
+        }
+    }
+    CHECK_EQ(points, "cfsefse");
+    CHECK_EQ(recorder.events().size(), 11u);
+}
+
+TEST_CASE("test timer trace on executor threads")
+{
+    trace_recorder recorder;
+    timer_options options;
+    options.executor_threads = 2;
+    options.trace_sink = &recorder;
+    detail::timer_mgr mgr(options);
+
+    std::atomic_int fired{ 0 };
+    for (auto i = 0; i < 4; ++i)
+    {
+        mgr.create_timer(5, [&fired]() { fired.fetch_add(1); }, "job");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    mgr.shutdown(timer_drain::run);
+    CHECK_EQ(fired.load(), 4);
+
+    // every timer is created, fired and dispatched once.
+    int counts[4] = { 0, 0, 0, 0 };
+    for (auto& event : recorder.events())
+    {
+        CHECK_EQ(std::string(event.label), "job");
+        ++counts[static_cast<size_t>(event.point)];
+    }
+    for (auto count : counts)
+    {
+        CHECK_EQ(count, 4);
+    }
+}
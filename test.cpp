@@ -1,7 +1,12 @@
 ﻿#include <iostream>
 #include <functional>
+#include <vector>
 
 #include "cxx-timer.h"
+#if defined(__linux__)
+#include <sys/wait.h>
+#include "cxx-timer-shm.h"
+#endif
 using namespace utility::timer;
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
@@ -83,3 +88,1522 @@ TEST_CASE("test timer accuacy")
     std::cout << "max_delta = " << max_delta << std::endl;
 }
 
+
+TEST_CASE("test timer idle wakeups")
+{
+    detail::timer_mgr mgr;
+    std::atomic_bool timer_fired { false };
+
+    // a idle scheduler only wakes up for the deadline.
+    mgr.create_timer(300, [&timer_fired]()
+    {
+        timer_fired.store(true);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK_LE(mgr.stats().wakeups, 2U);
+
+    // a earlier timer wakes up the scheduler at once.
+    std::atomic_bool early_fired { false };
+    mgr.create_timer(10, [&early_fired]()
+    {
+        early_fired.store(true);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_EQ(early_fired.load(), true);
+    CHECK_EQ(timer_fired.load(), false);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(timer_fired.load(), true);
+    CHECK_LE(mgr.stats().wakeups, 6U);
+}
+
+TEST_CASE("test timer async submit")
+{
+    timer_options options;
+    options.async_submit = true;
+    detail::timer_mgr mgr(options);
+
+    auto threads = 4;
+    auto count = 1000;
+    std::atomic_int fired_count { 0 };
+
+    std::vector<std::thread> producers;
+    for (auto i = 0; i < threads; ++i)
+    {
+        producers.emplace_back([&mgr, &fired_count, count]()
+        {
+            for (auto j = 0; j < count; ++j)
+            {
+                auto id = mgr.create_timer(50, [&fired_count]()
+                {
+                    fired_count.fetch_add(1);
+                });
+
+                // cancel a half of the timers.
+                if (j % 2 == 0)
+                {
+                    CHECK_EQ(mgr.cancel_timer(id), true);
+                }
+            }
+        });
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    CHECK_EQ(fired_count.load(), threads * count / 2);
+}
+
+// count the copies of a callback.
+struct copy_counter
+{
+    std::atomic_int* copies;
+    std::atomic_int* calls;
+
+    copy_counter(std::atomic_int* copies, std::atomic_int* calls)
+        : copies(copies), calls(calls) {}
+    copy_counter(const copy_counter& other)
+        : copies(other.copies), calls(other.calls) { copies->fetch_add(1); }
+    copy_counter(copy_counter&& other) noexcept
+        : copies(other.copies), calls(other.calls) {}
+
+    void operator()() { calls->fetch_add(1); }
+};
+
+// a move-only callback.
+struct move_only
+{
+    std::unique_ptr<int> ptr;
+    std::atomic_int* value;
+
+    void operator()() { value->store(*ptr); }
+};
+
+TEST_CASE("test timer_callback")
+{
+    std::atomic_int copies { 0 };
+    std::atomic_int calls { 0 };
+
+    // firing a repeat timer never copies the callback.
+    auto repeat = 5;
+    timer_iface::get().create_repeat_timer(1, repeat,
+                                          copy_counter(&copies, &calls));
+    std::this_thread::sleep_for(std::chrono::milliseconds(repeat * 2 + 20));
+    CHECK_EQ(calls.load(), repeat);
+    CHECK_EQ(copies.load(), 0);
+
+    // a move-only callable.
+    std::atomic_int value { 0 };
+    timer_iface::get().create_timer(1,
+        move_only{ std::unique_ptr<int>(new int(42)), &value });
+
+    // a callable larger than the inline buffer is stored on heap.
+    char large[timer_callback::inline_size * 2] = { 1 };
+    std::atomic_int large_value { 0 };
+    timer_iface::get().create_timer(1, [&large_value, large]()
+    {
+        large_value.store(large[0]);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK_EQ(value.load(), 42);
+    CHECK_EQ(large_value.load(), 1);
+
+    // moved callback leaves the source empty.
+    timer_callback cb([&calls]() { calls.fetch_add(1); });
+    timer_callback moved(std::move(cb));
+    CHECK_FALSE(cb);
+    CHECK(moved);
+    moved();
+    CHECK_EQ(calls.load(), repeat + 1);
+}
+
+TEST_CASE("test timer executor threads")
+{
+    timer_options options;
+    options.executor_threads = 4;
+    detail::timer_mgr mgr(options);
+
+    // slow callbacks of different timers run in parallel.
+    auto t0 = detail::tick_count();
+    std::atomic_int fired_count { 0 };
+    for (auto i = 0; i < 4; ++i)
+    {
+        mgr.create_timer(10, [&fired_count]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            fired_count.fetch_add(1);
+        });
+    }
+
+    while (fired_count.load() < 4)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_LT(detail::tick_count() - t0, 300);
+
+    // the callbacks of a repeat timer never overlap.
+    auto repeat = 20;
+    std::atomic_int running { 0 };
+    std::atomic_int overlaps { 0 };
+    std::atomic_int repeat_count { 0 };
+    mgr.create_repeat_timer(1, repeat, [&]()
+    {
+        if (running.fetch_add(1) != 0)
+        {
+            overlaps.fetch_add(1);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        running.fetch_sub(1);
+        repeat_count.fetch_add(1);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(repeat * 3 + 100));
+    CHECK_EQ(repeat_count.load(), repeat);
+    CHECK_EQ(overlaps.load(), 0);
+}
+
+// the executor of a application event loop.
+struct loop_executor : timer_executor
+{
+    std::mutex mtx;
+    std::vector<timer_task> tasks;
+
+    void post(const timer_task* batch, size_t count) override
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        tasks.insert(tasks.end(), batch, batch + count);
+    }
+
+    size_t run_once()
+    {
+        std::vector<timer_task> batch;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            batch.swap(tasks);
+        }
+
+        for (auto& task : batch)
+        {
+            task();
+        }
+        return batch.size();
+    }
+};
+
+TEST_CASE("test timer custom executor")
+{
+    loop_executor loop;
+    timer_options options;
+    options.executor = &loop;
+
+    detail::timer_mgr mgr(options);
+
+    auto repeat = 3;
+    std::atomic_int fired_count { 0 };
+    std::thread::id fired_thread;
+    mgr.create_repeat_timer(5, repeat, [&]()
+    {
+        fired_thread = std::this_thread::get_id();
+        fired_count.fetch_add(1);
+    });
+
+    // the callbacks only run when the loop runs them.
+    std::this_thread::sleep_for(std::chrono::milliseconds(repeat * 5 + 20));
+    CHECK_EQ(fired_count.load(), 0);
+
+    CHECK_GE(loop.run_once(), 1U);
+    CHECK_EQ(fired_count.load(), repeat);
+    CHECK_EQ(fired_thread, std::this_thread::get_id());
+}
+
+TEST_CASE("test timer batched hand-off")
+{
+    detail::timer_mgr mgr;
+
+    const auto count = 100;
+    std::atomic_int fired_count { 0 };
+    for (auto i = 0; i < count; ++i)
+    {
+        mgr.create_timer(20, [&fired_count]() { fired_count.fetch_add(1); });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(fired_count.load(), count);
+
+    // the timers of the same expired time are handed off together.
+    auto stats = mgr.stats();
+    CHECK_EQ(stats.batched_events, static_cast<uint64_t>(count));
+    CHECK_GE(stats.batches, 1U);
+    CHECK_LT(stats.batches, static_cast<uint64_t>(count));
+    CHECK_GE(stats.max_batch, 2U);
+}
+
+TEST_CASE("test timer manual drive")
+{
+    timer_options options;
+    options.manual_drive = true;
+    CHECK_FALSE(timer_iface::create(options));
+
+    timer_mgr mgr(options);
+    CHECK_EQ(mgr.next_timeout(), -1);
+
+    std::atomic_int fired_count { 0 };
+    std::thread::id fired_thread;
+    mgr.create_timer(10, [&]()
+    {
+        fired_thread = std::this_thread::get_id();
+        fired_count.fetch_add(1);
+
+        // create a timer from the callback.
+        mgr.create_timer(10, [&]() { fired_count.fetch_add(1); });
+    });
+
+    auto timeout = mgr.next_timeout();
+    CHECK_GE(timeout, 0);
+    CHECK_LE(timeout, 10);
+
+    // nothing fires until the application advances the timer.
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK_EQ(fired_count.load(), 0);
+    CHECK_EQ(mgr.next_timeout(), 0);
+
+    CHECK_EQ(mgr.advance(), 1U);
+    CHECK_EQ(fired_count.load(), 1);
+    CHECK_EQ(fired_thread, std::this_thread::get_id());
+
+    // advance to a given time.
+    CHECK_GT(mgr.next_timeout(), 0);
+    CHECK_EQ(mgr.advance(detail::tick_count_us() + 10 * 1000), 1U);
+    CHECK_EQ(fired_count.load(), 2);
+    CHECK_EQ(mgr.next_timeout(), -1);
+}
+
+TEST_CASE("test timer microsecond resolution")
+{
+    timer_options options;
+    options.spin_usec = 200;
+
+    detail::timer_mgr mgr(options);
+
+    const auto repeat = 50;
+    auto interval = std::chrono::microseconds(200);
+    std::atomic_int fired_count { 0 };
+    std::atomic<int64_t> last_fired { 0 };
+
+    auto t0 = detail::tick_count_us();
+    mgr.create_repeat_timer(interval, repeat, [&]()
+    {
+        last_fired.store(detail::tick_count_us());
+        fired_count.fetch_add(1);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(fired_count.load(), repeat);
+
+    // the last one fires after 10ms, not rounded to milliseconds.
+    CHECK_GE(last_fired.load() - t0, repeat * interval.count());
+    CHECK_LT(last_fired.load() - t0, repeat * interval.count() + 5000);
+
+    // a duration of milliseconds.
+    std::atomic_bool timer_fired { false };
+    mgr.create_timer(std::chrono::milliseconds(1), [&timer_fired]()
+    {
+        timer_fired.store(true);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK_EQ(timer_fired.load(), true);
+}
+
+TEST_CASE("test timer native backend")
+{
+    timer_options options;
+    options.backend = timer_backend::native;
+
+    detail::timer_mgr mgr(options);
+
+    std::atomic_bool timer_fired { false };
+    mgr.create_timer(300, [&timer_fired]() { timer_fired.store(true); });
+
+    // a earlier timer wakes up the kernel armed waiter.
+    std::atomic<int64_t> fired_time { 0 };
+    auto t0 = detail::tick_count_us();
+    mgr.create_timer(std::chrono::microseconds(2000), [&fired_time]()
+    {
+        fired_time.store(detail::tick_count_us());
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_GE(fired_time.load() - t0, 2000);
+    CHECK_LT(fired_time.load() - t0, 7000);
+    CHECK_EQ(timer_fired.load(), false);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK_EQ(timer_fired.load(), true);
+    CHECK_LE(mgr.stats().wakeups, 4U);
+}
+
+TEST_CASE("test timer slack coalescing")
+{
+    detail::timer_mgr mgr;
+
+    // deadlines spread over 40ms, each may fire up to 50ms late.
+    const auto count = 40;
+    std::atomic_int fired_count { 0 };
+    std::atomic_int out_of_window { 0 };
+    auto t0 = detail::tick_count_us();
+    for (auto i = 0; i < count; ++i)
+    {
+        timer_spec spec;
+        spec.interval = std::chrono::milliseconds(100 + i);
+        spec.slack = std::chrono::milliseconds(50);
+        auto deadline = t0 + spec.interval.count();
+        mgr.create_timer(spec, [&, deadline]()
+        {
+            auto now = detail::tick_count_us();
+            if (now < deadline || now > deadline + 50 * 1000 + 10 * 1000)
+            {
+                out_of_window.fetch_add(1);
+            }
+            fired_count.fetch_add(1);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    CHECK_EQ(fired_count.load(), count);
+    CHECK_EQ(out_of_window.load(), 0);
+
+    // a few shared wakeups instead of one per deadline.
+    auto stats = mgr.stats();
+    CHECK_LE(stats.batches, 3U);
+    CHECK_LE(stats.wakeups, 6U);
+}
+
+TEST_CASE("test timer cancel unlinks")
+{
+    for (auto async_submit : { false, true })
+    {
+        timer_options options;
+        options.async_submit = async_submit;
+        detail::timer_mgr mgr(options);
+
+        // arm a long timeout and cancel it, the canceled timers are
+        // freed at once instead of waiting for the deadline.
+        std::atomic_int fired_count { 0 };
+        for (auto i = 0; i < 100000; ++i)
+        {
+            auto id = mgr.create_timer(60 * 1000, [&fired_count]()
+            {
+                fired_count.fetch_add(1);
+            });
+            CHECK(mgr.cancel_timer(id));
+            CHECK_FALSE(mgr.cancel_timer(id));
+        }
+
+        mgr.create_timer(1, [&fired_count]() { fired_count.fetch_add(1); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK_EQ(fired_count.load(), 1);
+        // a few chunks, not one timer per canceled timeout.
+        CHECK_LE(mgr.stats().pool_capacity, 16384U);
+    }
+}
+
+TEST_CASE("test timer reset and postpone")
+{
+    for (auto async_submit : { false, true })
+    {
+        timer_options options;
+        options.async_submit = async_submit;
+        detail::timer_mgr mgr(options);
+
+        // a keepalive pushed back on traffic never fires.
+        std::atomic_int fired_count { 0 };
+        auto id = mgr.create_timer(30, [&fired_count]()
+        {
+            fired_count.fetch_add(1);
+        });
+        for (auto i = 0; i < 10; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            CHECK(mgr.reset_timer(id, 30));
+        }
+        CHECK_EQ(fired_count.load(), 0);
+
+        CHECK(mgr.postpone_timer(id, std::chrono::milliseconds(20)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(35));
+        CHECK_EQ(fired_count.load(), 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        CHECK_EQ(fired_count.load(), 1);
+        CHECK_FALSE(mgr.reset_timer(id, 10));
+
+        // a earlier deadline is re-bucketed at once.
+        std::atomic<int64_t> fired_time { 0 };
+        auto t0 = detail::tick_count();
+        id = mgr.create_timer(1000, [&fired_time]()
+        {
+            fired_time.store(detail::tick_count());
+        });
+        CHECK(mgr.reset_timer(id, 10));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK_GT(fired_time.load(), 0);
+        CHECK_LT(fired_time.load() - t0, 30);
+
+        CHECK(mgr.cancel_timer(mgr.create_timer(10, []() {})));
+        CHECK_FALSE(mgr.postpone_timer(-1, 10));
+    }
+
+    // a reset at the moment of the last fire gets one more fire: the
+    // schedule thread is held in the fire by a full executor queue.
+    {
+        using namespace std::chrono;
+
+        timer_options options;
+        options.max_queued_callbacks = 1;
+        options.overload = timer_overload::block;
+        detail::timer_mgr mgr(options);
+
+        std::atomic_bool release{ false };
+        std::atomic_int fired{ 0 };
+        mgr.create_timer(1, [&release]()
+        {
+            while (!release.load())
+            {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        });
+        mgr.create_timer(5, []() {});
+        auto id = mgr.create_timer(10, [&fired]() { fired.fetch_add(1); });
+
+        std::this_thread::sleep_for(milliseconds(30));
+        CHECK(mgr.reset_timer(id, 20));
+        release.store(true);
+
+        std::this_thread::sleep_for(milliseconds(10));
+        CHECK_EQ(fired.load(), 1);
+        std::this_thread::sleep_for(milliseconds(30));
+        CHECK_EQ(fired.load(), 2);
+        CHECK_FALSE(mgr.reset_timer(id, 20));
+    }
+
+    // a once timer fired can't be reset by its callback, a repeat one can.
+    {
+        timer_options options;
+        options.manual_drive = true;
+        detail::virtual_timer_mgr mgr(options);
+
+        auto reset = -1;
+        timer_id_t id = -1;
+        id = mgr.create_timer(10, [&]() { reset = mgr.reset_timer(id, 5); });
+        CHECK_EQ(mgr.advance(std::chrono::milliseconds(10)), 1U);
+        CHECK_EQ(reset, 0);
+        CHECK_EQ(mgr.advance(std::chrono::milliseconds(50)), 0U);
+
+        id = mgr.create_repeat_timer(10, 2, [&]()
+        {
+            reset = mgr.reset_timer(id, 5);
+        });
+        CHECK_EQ(mgr.advance(std::chrono::milliseconds(10)), 1U);
+        CHECK_EQ(reset, 1);
+        CHECK_EQ(mgr.advance(std::chrono::milliseconds(5)), 1U);
+        CHECK_EQ(reset, 0);
+        CHECK_EQ(mgr.next_timeout(), -1);
+    }
+}
+
+TEST_CASE("test timer bulk create and cancel")
+{
+    for (auto async_submit : { false, true })
+    {
+        timer_options options;
+        options.async_submit = async_submit;
+        detail::timer_mgr mgr(options);
+
+        const size_t count = 1000;
+        std::atomic_int fired_count { 0 };
+        std::vector<timer_spec> specs(count);
+        std::vector<timer_callback> cbs;
+        for (size_t i = 0; i < count; ++i)
+        {
+            specs[i].interval = std::chrono::milliseconds(10 + i % 20);
+            cbs.emplace_back([&fired_count]() { fired_count.fetch_add(1); });
+        }
+
+        std::vector<timer_id_t> ids(count);
+        CHECK_EQ(mgr.create_timers(specs.data(), cbs.data(), count,
+                                   ids.data()), count);
+
+        // cancel the half of them.
+        std::vector<timer_id_t> canceled;
+        for (size_t i = 0; i < count; i += 2)
+        {
+            canceled.push_back(ids[i]);
+        }
+        CHECK_EQ(mgr.cancel_timers(canceled.data(), canceled.size()),
+                 count / 2);
+        CHECK_EQ(mgr.cancel_timers(canceled.data(), canceled.size()), 0U);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        CHECK_EQ(fired_count.load(), static_cast<int>(count / 2));
+    }
+}
+
+TEST_CASE("test timer catch-up policy")
+{
+    timer_options options;
+    options.manual_drive = true;
+    detail::timer_mgr mgr(options);
+
+    struct result_t
+    {
+        int calls = 0;
+        uint32_t missed = 0;
+    };
+
+    auto create = [&mgr](timer_catch_up catch_up, int32_t repeat,
+                         result_t& result)
+    {
+        timer_spec spec;
+        spec.interval = std::chrono::milliseconds(10);
+        spec.repeat = repeat;
+        spec.catch_up = catch_up;
+        return mgr.create_timer(spec, [&result](uint32_t missed)
+        {
+            result.calls += 1;
+            result.missed += missed;
+        });
+    };
+
+    result_t fire_all, coalesce, skip, coalesce3, skip3;
+    auto t0 = detail::tick_count_us();
+    auto forever = create(timer_catch_up::fire_all, timer_spec::forever,
+                          fire_all);
+    create(timer_catch_up::coalesce, 0, coalesce);
+    create(timer_catch_up::skip, 0, skip);
+    create(timer_catch_up::coalesce, 3, coalesce3);
+    create(timer_catch_up::skip, 3, skip3);
+
+    // a stall of 5 ticks.
+    mgr.advance(t0 + 55 * 1000);
+    CHECK_EQ(fire_all.calls, 5);
+    CHECK_EQ(fire_all.missed, 0U);
+    CHECK_EQ(coalesce.calls, 1);
+    CHECK_EQ(coalesce.missed, 4U);
+    CHECK_EQ(skip.calls, 1);
+    CHECK_EQ(skip.missed, 4U);
+    CHECK_EQ(coalesce3.calls, 1);
+    CHECK_EQ(coalesce3.missed, 2U);
+
+    // the next ticks stay aligned, the skipped ones don't count.
+    mgr.advance(t0 + 75 * 1000);
+    CHECK_EQ(fire_all.calls, 7);
+    CHECK_EQ(coalesce.calls, 2);
+    CHECK_EQ(coalesce.missed, 5U);
+    CHECK_EQ(skip.calls, 2);
+    CHECK_EQ(coalesce3.calls, 1);
+    CHECK_EQ(skip3.calls, 2);
+
+    mgr.advance(t0 + 200 * 1000);
+    CHECK_EQ(skip3.calls, 3);
+    CHECK_GT(fire_all.calls, 7);
+
+    // a infinite repeat timer runs until canceled.
+    CHECK(mgr.cancel_timer(forever));
+    auto calls = fire_all.calls;
+    mgr.advance(t0 + 300 * 1000);
+    CHECK_EQ(fire_all.calls, calls);
+
+    // a repeat timer of no interval is rejected, a once one fires.
+    CHECK_EQ(mgr.create_repeat_timer(0, timer_spec::forever, []() {}), -1);
+    CHECK_EQ(mgr.create_repeat_timer(0, 3, []() {}), -1);
+    auto once = 0;
+    CHECK_GE(mgr.create_timer(0, [&once]() { ++once; }), 0);
+
+    timer_spec specs[2];
+    specs[0].repeat = timer_spec::forever;
+    specs[1].interval = std::chrono::milliseconds(1);
+    specs[1].repeat = timer_spec::forever;
+    timer_callback cbs[2] = { []() {}, []() {} };
+    timer_id_t ids[2];
+    CHECK_EQ(mgr.create_timers(specs, cbs, 2, ids), 1U);
+    CHECK_EQ(ids[0], -1);
+    CHECK(mgr.cancel_timer(ids[1]));
+    mgr.advance(t0 + 400 * 1000);
+    CHECK_EQ(once, 1);
+}
+
+TEST_CASE("test timer_histogram")
+{
+    timer_histogram histogram;
+    CHECK_EQ(histogram.count(), 0U);
+    CHECK_EQ(histogram.percentile(99), 0U);
+
+    // the buckets cover every microsecond without gaps.
+    for (auto bucket = 1; bucket < timer_histogram::buckets; ++bucket)
+    {
+        auto lower = timer_histogram::lower_of(bucket);
+        CHECK_EQ(timer_histogram::bucket_of(lower), bucket);
+        CHECK_EQ(timer_histogram::bucket_of(lower - 1), bucket - 1);
+    }
+
+    for (uint64_t value = 1; value <= 1000; ++value)
+    {
+        histogram.record(value);
+    }
+
+    CHECK_EQ(histogram.count(), 1000U);
+    CHECK_EQ(histogram.max(), 1000U);
+    CHECK_EQ(histogram.mean(), 500U);
+
+    // the relative error is within 1/16.
+    CHECK_GE(histogram.percentile(50), 500U);
+    CHECK_LE(histogram.percentile(50), 500U + 500U / 16);
+    CHECK_GE(histogram.percentile(99), 990U);
+    CHECK_LE(histogram.percentile(99.9), 1000U);
+    CHECK_EQ(histogram.percentile(100), 1000U);
+
+    timer_histogram other;
+    other.record(1ULL << 40);
+    histogram.merge(other);
+    CHECK_EQ(histogram.count(), 1001U);
+    CHECK_EQ(histogram.percentile(100), 1ULL << 40);
+}
+
+#ifndef UTILITY_TIMER_NO_STATS
+TEST_CASE("test timer latency stats")
+{
+    timer_options options;
+    options.manual_drive = true;
+    detail::timer_mgr mgr(options);
+
+    const auto count = 10;
+    for (auto i = 0; i < count; ++i)
+    {
+        mgr.create_timer(10, []()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+    }
+
+    mgr.create_timer(60 * 1000, []() {});
+    CHECK_EQ(mgr.stats().pending_timers, static_cast<uint64_t>(count + 1));
+
+    // fire the timers 5ms after the deadline.
+    CHECK_EQ(mgr.advance(detail::tick_count_us() + 15 * 1000),
+             static_cast<size_t>(count));
+
+    auto stats = mgr.stats();
+    CHECK_EQ(stats.pending_timers, 1U);
+    CHECK_GT(stats.elapsed_usec, 0U);
+
+    CHECK_EQ(stats.lateness.count(), static_cast<uint64_t>(count));
+    CHECK_GE(stats.lateness.percentile(50), 4000U);
+    CHECK_LE(stats.lateness.percentile(50), 6000U);
+
+    CHECK_EQ(stats.queue_delay.count(), static_cast<uint64_t>(count));
+    CHECK_EQ(stats.run_time.count(), static_cast<uint64_t>(count));
+    CHECK_GE(stats.run_time.percentile(50), 1000U);
+    CHECK_GE(stats.run_time.max(), stats.run_time.percentile(99));
+}
+#endif
+
+namespace
+{
+
+// a fake clock moved by the test, shared by the copies.
+struct manual_test_clock
+{
+    std::shared_ptr<int64_t> ticks = std::make_shared<int64_t>(0);
+
+    int64_t now() const { return *ticks; }
+};
+
+} // namespace
+
+TEST_CASE("test timer policies")
+{
+    // a single-threaded timer on a fake clock, fully deterministic.
+    using mgr_t = detail::basic_timer_mgr<detail::wheel_queue,
+                                          manual_test_clock,
+                                          detail::null_lock>;
+    timer_options options;
+    options.manual_drive = true;
+    mgr_t mgr(options);
+
+    auto fired = 0;
+    mgr.create_timer(10, [&fired]() { ++fired; });
+    mgr.create_repeat_timer(std::chrono::microseconds(300), 3,
+                            [&fired](uint32_t missed)
+    {
+        fired += 100 * static_cast<int>(missed + 1);
+    });
+    CHECK_EQ(mgr.next_timeout(), 1);
+
+    // the repeat ticks are coalesced into one call.
+    *mgr.clock().ticks = 9 * 1000;
+    CHECK_EQ(mgr.advance(), 1U);
+    CHECK_EQ(fired, 300);
+    CHECK_EQ(mgr.next_timeout(), 1);
+
+    // nothing fires until the clock moves.
+    CHECK_EQ(mgr.advance(), 0U);
+    *mgr.clock().ticks = 10 * 1000;
+    CHECK_EQ(mgr.advance(), 1U);
+    CHECK_EQ(fired, 301);
+    CHECK_EQ(mgr.next_timeout(), -1);
+
+    // the default policies keep the existing timer_mgr.
+    static_assert(std::is_same<detail::wheel_timer_mgr,
+        detail::basic_timer_mgr<detail::wheel_queue, detail::tick_clock,
+                                std::mutex>>::value, "default policies");
+}
+
+TEST_CASE("test timer thread options")
+{
+    timer_options options;
+    options.schedule_thread.name = "test-schedule";
+    options.executor_thread.name = "test-event";
+    options.executor_thread.cpus = { 0 };
+
+    detail::timer_mgr mgr(options);
+
+    std::atomic_bool fired{ false };
+    std::string name;
+    int cpu = -1;
+    mgr.create_timer(1, [&]()
+    {
+#if defined(__linux__)
+        char buffer[16] = {};
+        ::pthread_getname_np(::pthread_self(), buffer, sizeof(buffer));
+        name = buffer;
+        cpu = ::sched_getcpu();
+#endif
+        fired.store(true);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(fired.load());
+#if defined(__linux__)
+    CHECK_EQ(name, "test-event");
+    CHECK_EQ(cpu, 0);
+#endif
+
+    // the pool threads are named by index.
+    auto applied = false;
+    std::thread([&applied]()
+    {
+        timer_thread_options thread_options;
+        applied = detail::apply_thread_options(thread_options, "worker", 3);
+#if defined(__linux__)
+        char buffer[16] = {};
+        ::pthread_getname_np(::pthread_self(), buffer, sizeof(buffer));
+        CHECK_EQ(std::string(buffer), "worker-3");
+#endif
+    }).join();
+    CHECK(applied);
+}
+
+TEST_CASE("test timer shutdown")
+{
+    using namespace std::chrono;
+
+    // the callbacks queued behind a slow one.
+    auto slow_timers = [](detail::timer_mgr& mgr, std::atomic_int& fired)
+    {
+        for (auto i = 0; i < 5; ++i)
+        {
+            mgr.create_timer(1, [&fired]()
+            {
+                std::this_thread::sleep_for(milliseconds(20));
+                fired.fetch_add(1);
+            });
+        }
+
+        std::this_thread::sleep_for(milliseconds(10));
+    };
+
+    {
+        detail::timer_mgr mgr;
+        std::atomic_int fired{ 0 };
+        slow_timers(mgr, fired);
+
+        // the running one is finished, the others are dropped.
+        auto start = steady_clock::now();
+        auto dropped = mgr.shutdown(timer_drain::discard);
+        CHECK_LT(steady_clock::now() - start, milliseconds(45));
+        CHECK_GE(dropped, 3U);
+        CHECK_EQ(fired.load() + static_cast<int>(dropped), 5);
+
+        CHECK_EQ(mgr.create_timer(1, []() {}), timer_id_t(-1));
+        CHECK_EQ(mgr.shutdown(), 0U);
+    }
+
+    {
+        detail::timer_mgr mgr;
+        std::atomic_int fired{ 0 };
+        slow_timers(mgr, fired);
+
+        CHECK_EQ(mgr.shutdown(timer_drain::run), 0U);
+        CHECK_EQ(fired.load(), 5);
+    }
+
+    {
+        // the timers due but not handed off yet.
+        timer_options options;
+        options.manual_drive = true;
+        detail::timer_mgr mgr(options);
+
+        std::atomic_int fired{ 0 };
+        for (auto i = 0; i < 3; ++i)
+        {
+            mgr.create_timer(1, [&fired]() { fired.fetch_add(1); });
+        }
+        mgr.create_timer(60 * 1000, [&fired]() { fired.fetch_add(1); });
+
+        std::this_thread::sleep_for(milliseconds(5));
+        CHECK_EQ(mgr.shutdown(timer_drain::run), 0U);
+        CHECK_EQ(fired.load(), 3);
+    }
+
+    {
+        timer_options options;
+        options.executor_threads = 2;
+        detail::timer_mgr mgr(options);
+
+        std::atomic_int fired{ 0 };
+        slow_timers(mgr, fired);
+
+        auto dropped = mgr.shutdown(timer_drain::discard);
+        CHECK_GE(dropped, 1U);
+        CHECK_EQ(fired.load() + static_cast<int>(dropped), 5);
+    }
+}
+
+TEST_CASE("test timer virtual time")
+{
+    using namespace std::chrono;
+
+    timer_options options;
+    options.manual_drive = true;
+    detail::virtual_timer_mgr mgr(options);
+
+    // hours of timers without sleeping, in deadline order.
+    std::vector<int64_t> fired;
+    auto& clock = mgr.clock();
+    mgr.create_timer(hours(1), [&]()
+    {
+        fired.push_back(clock.now());
+
+        // fire in the same advance.
+        mgr.create_timer(milliseconds(5), [&]()
+        {
+            fired.push_back(clock.now());
+        });
+    });
+
+    auto ticks = 0;
+    mgr.create_repeat_timer(seconds(1), timer_spec::forever,
+                            [&ticks]() { ++ticks; });
+
+    auto start = steady_clock::now();
+    CHECK_EQ(mgr.advance(hours(2)), 7200U + 2U);
+    CHECK_LT(steady_clock::now() - start, seconds(1));
+
+    CHECK_EQ(ticks, 7200);
+    CHECK_EQ(clock.now(), duration_cast<microseconds>(hours(2)).count());
+    REQUIRE_EQ(fired.size(), 2U);
+    CHECK_EQ(fired[0], duration_cast<microseconds>(hours(1)).count());
+    CHECK_EQ(fired[1], fired[0] + 5000);
+
+    // the deadlines are shifted by the paused time.
+    mgr.create_timer(milliseconds(10), [&ticks]() { ticks = -1; });
+    CHECK(mgr.pause());
+    CHECK_FALSE(mgr.pause());
+    CHECK_EQ(mgr.advance(seconds(10)), 0U);
+    CHECK_EQ(mgr.next_timeout(), -1);
+    CHECK(mgr.resume());
+    CHECK_FALSE(mgr.resume());
+
+    CHECK_EQ(mgr.advance(microseconds(9999)), 0U);
+    CHECK_EQ(ticks, 7200);
+    CHECK_EQ(mgr.next_timeout(), 1);
+    CHECK_EQ(mgr.advance(microseconds(1)), 1U);
+    CHECK_EQ(ticks, -1);
+}
+
+TEST_CASE("test timer pause and resume")
+{
+    detail::timer_mgr mgr;
+
+    std::atomic_int fired{ 0 };
+    mgr.create_timer(10, [&fired]() { fired.fetch_add(1); });
+    CHECK(mgr.pause());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_EQ(fired.load(), 0);
+
+    CHECK(mgr.resume());
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    CHECK_EQ(fired.load(), 1);
+}
+
+TEST_CASE("test timer overload")
+{
+    using namespace std::chrono;
+
+    // 10 callbacks due while the event thread is held by a slow one,
+    // 4 of them fit the queue.
+    auto overload = [](timer_overload policy, timer_stats& stats)
+    {
+        timer_options options;
+        options.max_queued_callbacks = 4;
+        options.overload = policy;
+        detail::timer_mgr mgr(options);
+
+        std::atomic_bool release{ false };
+        std::atomic_int fired{ 0 };
+        mgr.create_timer(1, [&release]()
+        {
+            while (!release.load())
+            {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        });
+
+        std::this_thread::sleep_for(milliseconds(10));
+        for (auto i = 0; i < 10; ++i)
+        {
+            mgr.create_timer(5, [&fired]() { fired.fetch_add(1); });
+        }
+
+        std::this_thread::sleep_for(milliseconds(30));
+        stats = mgr.stats();
+        release.store(true);
+        mgr.shutdown(timer_drain::run);
+        return fired.load();
+    };
+
+    timer_stats stats;
+    CHECK_EQ(overload(timer_overload::drop_newest, stats), 4);
+    CHECK_EQ(stats.queued_callbacks, 4U);
+    CHECK_EQ(stats.dropped_callbacks, 6U);
+
+    CHECK_EQ(overload(timer_overload::run_inline, stats), 10);
+    CHECK_EQ(stats.queued_callbacks, 4U);
+    CHECK_EQ(stats.inline_callbacks, 6U);
+
+    // the scheduler waits until the queue has room.
+    CHECK_EQ(overload(timer_overload::block, stats), 10);
+    CHECK_EQ(stats.queued_callbacks, 4U);
+    CHECK_EQ(stats.dropped_callbacks, 0U);
+    // the callbacks flushed by the waiting pass are not a batch of their
+    // own, the pass is counted once it is finished.
+    CHECK_LT(stats.batched_events, 5U);
+
+    // a fast repeat timer never grows the queue over the limit.
+    for (auto policy : { timer_overload::drop_newest,
+                         timer_overload::run_inline,
+                         timer_overload::block })
+    {
+        for (auto ordered : { false, true })
+        {
+            timer_options options;
+            options.max_queued_callbacks = 8;
+            options.overload = policy;
+            options.ordered_callbacks = ordered;
+            detail::timer_mgr mgr(options);
+
+            mgr.create_repeat_timer(microseconds(100), timer_spec::forever,
+                                    []()
+            {
+                std::this_thread::sleep_for(milliseconds(20));
+            });
+
+            for (auto i = 0; i < 10; ++i)
+            {
+                std::this_thread::sleep_for(milliseconds(5));
+                CHECK_LE(mgr.stats().queued_callbacks, 8U);
+            }
+            mgr.shutdown();
+        }
+    }
+}
+
+TEST_CASE("test timer lanes")
+{
+    using namespace std::chrono;
+
+    auto lane_spec = [](timer_lane lane, int32_t msec)
+    {
+        timer_spec spec;
+        spec.interval = milliseconds(msec);
+        spec.lane = lane;
+        return spec;
+    };
+
+    // the lanes queued while the event thread is held run in order.
+    {
+        detail::timer_mgr mgr;
+        std::atomic_bool release{ false };
+        std::string order;
+        mgr.create_timer(lane_spec(timer_lane::normal, 1), [&release]()
+        {
+            while (!release.load())
+            {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        });
+
+        for (auto i = 0; i < 3; ++i)
+        {
+            mgr.create_timer(lane_spec(timer_lane::background, 1),
+                             [&order]() { order += 'b'; });
+            mgr.create_timer(lane_spec(timer_lane::normal, 1),
+                             [&order]() { order += 'n'; });
+        }
+
+        // the high one overtakes the ones queued before it.
+        mgr.create_timer(lane_spec(timer_lane::high, 10),
+                         [&order]() { order += 'h'; });
+
+        std::this_thread::sleep_for(milliseconds(30));
+        release.store(true);
+        mgr.shutdown(timer_drain::run);
+        CHECK_EQ(order, "hnnnbbb");
+    }
+
+    // a high task preempts the normal batch running between its tasks.
+    {
+        struct probe
+        {
+            std::atomic_bool started{ false };
+            std::atomic_bool release{ false };
+            std::string order;
+        } state;
+
+        auto hold = [](void* owner, void*, int64_t)
+        {
+            auto probe_state = static_cast<probe*>(owner);
+            probe_state->started.store(true);
+            while (!probe_state->release.load())
+            {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        };
+        auto mark = [](void* owner, void* tag, int64_t)
+        {
+            static_cast<probe*>(owner)->order += *static_cast<char*>(tag);
+        };
+
+        static char normal = 'n';
+        static char high = 'h';
+        timer_task batch[] = {
+            timer_task(hold, &state, nullptr),
+            timer_task(mark, &state, &normal),
+            timer_task(mark, &state, &normal),
+            timer_task(mark, &state, &normal),
+        };
+
+        // one post is taken as one batch.
+        detail::event_thread thread;
+        thread.post(timer_lane::normal, batch, 4);
+        while (!state.started.load())
+        {
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+
+        timer_task urgent(mark, &state, &high);
+        thread.post(timer_lane::high, &urgent, 1);
+        state.release.store(true);
+        thread.shutdown(timer_drain::run, steady_clock::time_point::max());
+        CHECK_EQ(state.order, "hnnn");
+    }
+
+    // the high lane of its own thread is not held.
+    {
+        timer_options options;
+        options.lane_threads = true;
+        detail::timer_mgr mgr(options);
+
+        std::atomic_bool release{ false };
+        std::atomic_int fired{ 0 };
+        mgr.create_timer(lane_spec(timer_lane::normal, 1), [&release]()
+        {
+            while (!release.load())
+            {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+        });
+        mgr.create_timer(lane_spec(timer_lane::high, 5),
+                         [&fired]() { fired.fetch_add(1); });
+        mgr.create_timer(lane_spec(timer_lane::background, 5),
+                         [&fired]() { fired.fetch_add(1); });
+
+        std::this_thread::sleep_for(milliseconds(30));
+        CHECK_EQ(fired.load(), 2);
+        release.store(true);
+    }
+}
+
+TEST_CASE("test timer save and restore")
+{
+    using namespace std::chrono;
+
+    std::vector<std::string> fired;
+    uint32_t missed = 0;
+    timer_registry registry;
+    CHECK(registry.add("job", [&fired](const std::string& data)
+    {
+        return timer_callback([&fired, data]() { fired.push_back(data); });
+    }));
+    CHECK(registry.add("tick", [&missed](const std::string&)
+    {
+        return timer_callback([&missed](uint32_t n) { missed += n; });
+    }));
+    CHECK_FALSE(registry.add("job", nullptr));
+
+    timer_options options;
+    options.manual_drive = true;
+    std::string path = "timer-test.snapshot";
+    std::map<timer_id_t, timer_id_t> ids;
+    timer_id_t saved_id = -1;
+    {
+        detail::virtual_timer_mgr mgr(options);
+
+        timer_spec spec;
+        spec.interval = hours(1);
+        saved_id = mgr.create_persistent_timer(spec, registry, "job", "a");
+        CHECK_GE(saved_id, 0);
+
+        spec.interval = seconds(10);
+        spec.repeat = 5;
+        CHECK_GE(mgr.create_persistent_timer(spec, registry, "job", "b"), 0);
+
+        auto canceled = mgr.create_persistent_timer(spec, registry, "job",
+                                                    "c");
+        CHECK(mgr.cancel_timer(canceled));
+        CHECK_EQ(mgr.create_persistent_timer(spec, registry, "none"), -1);
+        mgr.create_timer(seconds(1), [&fired]() { fired.push_back("x"); });
+
+        CHECK_EQ(mgr.advance(seconds(25)), 3U);
+        CHECK_EQ(mgr.save_timers(path), 2);
+    }
+
+    // the repeats left keep the ticks, the deadlines are kept.
+    {
+        detail::virtual_timer_mgr mgr(options);
+        CHECK_EQ(mgr.restore_timers(path, registry, &ids), 2);
+        CHECK_EQ(ids.size(), 2U);
+        CHECK_EQ(ids.count(saved_id), 1U);
+
+        fired.clear();
+        CHECK_EQ(mgr.advance(seconds(30)), 3U);
+        CHECK_EQ(fired, std::vector<std::string>({ "b", "b", "b" }));
+        CHECK_EQ(mgr.advance(hours(1)), 1U);
+        CHECK_EQ(fired.back(), "a");
+#ifndef UTILITY_TIMER_NO_STATS
+        CHECK_EQ(mgr.stats().pending_timers, 0U);
+#endif
+    }
+
+    // the deadlines missed while saved are caught up.
+    {
+        detail::virtual_timer_mgr mgr(options);
+        timer_spec spec;
+        spec.interval = milliseconds(10);
+        spec.repeat = 10;
+        spec.catch_up = timer_catch_up::coalesce;
+        mgr.create_persistent_timer(spec, registry, "tick");
+        CHECK_EQ(mgr.save_timers(path), 1);
+    }
+
+    std::this_thread::sleep_for(milliseconds(35));
+    {
+        detail::virtual_timer_mgr mgr(options);
+        CHECK_EQ(mgr.restore_timers(path, timer_registry()), 0);
+        CHECK_EQ(mgr.restore_timers(path, registry), 1);
+        CHECK_EQ(mgr.advance(), 1U);
+        CHECK_GE(missed, 2U);
+    }
+
+    // a file of the other byte order is rejected.
+    {
+        auto file = std::fopen(path.c_str(), "r+b");
+        REQUIRE(file != nullptr);
+        unsigned char order[4];
+        std::fseek(file, 8, SEEK_SET);
+        CHECK_EQ(std::fread(order, 1, 4, file), 4U);
+        std::reverse(order, order + 4);
+        std::fseek(file, 8, SEEK_SET);
+        CHECK_EQ(std::fwrite(order, 1, 4, file), 4U);
+        std::fclose(file);
+
+        detail::virtual_timer_mgr mgr(options);
+        CHECK_EQ(mgr.restore_timers(path, registry), -1);
+    }
+
+    CHECK_EQ(std::remove(path.c_str()), 0);
+    CHECK_EQ(detail::virtual_timer_mgr(options).restore_timers(path, registry),
+             -1);
+}
+
+#if defined(__linux__)
+TEST_CASE("test shm_timer")
+{
+    auto name = "/cxx-timer-test-" + std::to_string(::getpid());
+    auto daemon = shm_timer_daemon::create(name);
+    REQUIRE(daemon);
+    // a second daemon never replaces the segment of a live one.
+    CHECK_FALSE(shm_timer_daemon::create(name));
+
+    auto timer = shm_timer::attach(name);
+    REQUIRE(timer);
+
+    std::atomic_int fired{ 0 };
+    std::atomic_int repeats{ 0 };
+    timer->create_timer(10, [&fired]() { fired.fetch_add(1); });
+    timer->create_repeat_timer(std::chrono::milliseconds(5), 3,
+                               [&repeats](uint32_t missed)
+    {
+        repeats.fetch_add(static_cast<int>(missed) + 1);
+    });
+
+    auto id = timer->create_timer(20, [&fired]() { fired.fetch_add(100); });
+    CHECK(timer->cancel_timer(id));
+    CHECK_FALSE(timer->cancel_timer(id));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    CHECK_EQ(fired.load(), 1);
+    CHECK_EQ(repeats.load(), 3);
+    CHECK_EQ(daemon->pending_timers(), 0U);
+
+    // the timers of another process.
+    auto pid = ::fork();
+    if (pid == 0)
+    {
+        auto child = shm_timer::attach(name, true);
+        auto child_fired = false;
+        if (child)
+        {
+            child->create_timer(5, [&child_fired]() { child_fired = true; });
+            for (int i = 0; i < 10 && !child_fired; ++i)
+            {
+                child->poll(100);
+            }
+
+            child.reset();
+        }
+
+        ::_exit(child_fired ? 0 : 1);
+    }
+
+    REQUIRE_GT(pid, 0);
+    int status = -1;
+    ::waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+    CHECK_EQ(WEXITSTATUS(status), 0);
+
+    // the segment is recreated after the daemon exits.
+    timer.reset();
+    daemon.reset();
+    CHECK_FALSE(shm_timer::attach(name));
+    daemon = shm_timer_daemon::create(name);
+    CHECK(daemon);
+    CHECK(shm_timer::attach(name));
+    daemon.reset();
+
+    // the segment left by a killed daemon is stale.
+    pid = ::fork();
+    if (pid == 0)
+    {
+        auto killed = shm_timer_daemon::create(name);
+        ::_exit(killed ? 0 : 1);
+    }
+
+    REQUIRE_GT(pid, 0);
+    ::waitpid(pid, &status, 0);
+    CHECK_EQ(WEXITSTATUS(status), 0);
+    daemon = shm_timer_daemon::create(name);
+    CHECK(daemon);
+    daemon.reset();
+    ::shm_unlink((name + ".lock").c_str());
+}
+#endif
+
+TEST_CASE("test sharded_timer")
+{
+    sharded_timer timer(4);
+    CHECK_EQ(timer.shards(), 4U);
+
+    std::atomic_int fired_count { 0 };
+    std::vector<timer_id_t> canceled(timer.shards());
+
+    // every thread creates timers on its own shard.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < timer.shards(); ++i)
+    {
+        threads.emplace_back([&timer, &fired_count, &canceled, i]()
+        {
+            sharded_timer::bind_thread(i);
+
+            auto id = timer.create_timer(10, [&fired_count]()
+            {
+                fired_count.fetch_add(1);
+            });
+            CHECK_EQ(static_cast<size_t>(id >> sharded_timer::shard_shift), i);
+
+            canceled[i] = timer.create_timer(10, [&fired_count]()
+            {
+                fired_count.fetch_add(1);
+            });
+        });
+    }
+
+    for (auto& thd : threads)
+    {
+        thd.join();
+    }
+
+    // cancel from another thread goes to the shard of the id.
+    for (auto id : canceled)
+    {
+        CHECK_EQ(timer.cancel_timer(id), true);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_EQ(fired_count.load(), 4);
+    CHECK_EQ(timer.cancel_timer(-1), false);
+
+    // a standalone instance.
+    auto standalone = timer_iface::create();
+    standalone->create_timer(1, [&fired_count]() { fired_count.fetch_add(1); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK_EQ(fired_count.load(), 5);
+}
+
+TEST_CASE_TEMPLATE("test scheduler queue expiry order", queue_t,
+                   detail::map_queue, detail::wheel_queue,
+                   detail::heap_queue)
+{
+    int64_t start = 1000;
+    queue_t queue(start);
+
+    // spread deadlines over every wheel level and beyond the wheel range.
+    auto count = 200;
+    std::unique_ptr<detail::timer_t[]> timers(new detail::timer_t[count]);
+    uint32_t seed = 12345;
+    for (int i = 0; i < count; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        timers[i].expires = start + (int64_t(1) << (seed >> 16) % 34) + seed % 97;
+        queue.push(&timers[i]);
+    }
+
+    int fired = 0;
+    int64_t prev = start;
+    for (int64_t now = start; fired < count;
+         now += 1 + (now - start) / 64 + (now % 4099))
+    {
+        detail::timer_bucket expired;
+        queue.pop_expired(now, expired);
+
+        while (auto timer = expired.pop_front())
+        {
+            // fired on the first pop after the deadline.
+            CHECK(timer->expires <= now);
+            CHECK(timer->expires > prev);
+            ++fired;
+        }
+
+        int64_t min_expires = std::numeric_limits<int64_t>::max();
+        for (int i = 0; i < count; ++i)
+        {
+            if (timers[i].expires > now)
+            {
+                min_expires = std::min(min_expires, timers[i].expires);
+            }
+        }
+        CHECK(queue.min_expires() <= min_expires);
+        prev = now;
+    }
+
+    CHECK_EQ(fired, count);
+}
+
+TEST_CASE_TEMPLATE("test scheduler queue erase", queue_t,
+                   detail::map_queue, detail::wheel_queue,
+                   detail::heap_queue)
+{
+    int64_t start = 1000;
+    queue_t queue(start);
+
+    // the timers of same expired time keep the insertion order.
+    auto count = 300;
+    std::unique_ptr<detail::timer_t[]> timers(new detail::timer_t[count]);
+    for (int i = 0; i < count; ++i)
+    {
+        timers[i].expires = start + 1 + (i * 37) % 100;
+        timers[i].slot = static_cast<uint32_t>(i);
+        queue.push(&timers[i]);
+    }
+
+    for (int i = 0; i < count; i += 3)
+    {
+        queue.erase(&timers[i]);
+    }
+    CHECK_LE(queue.min_expires(), start + 1);
+
+    detail::timer_bucket expired;
+    queue.pop_expired(start + 100, expired);
+
+    int fired = 0;
+    const detail::timer_t* prev = nullptr;
+    while (auto timer = expired.pop_front())
+    {
+        CHECK_NE(timer->slot % 3, 0U);
+        if (prev != nullptr)
+        {
+            CHECK((prev->expires < timer->expires ||
+                   (prev->expires == timer->expires &&
+                    prev->slot < timer->slot)));
+        }
+
+        prev = timer;
+        ++fired;
+    }
+
+    CHECK_EQ(fired, count - count / 3);
+    CHECK_EQ(queue.min_expires(), std::numeric_limits<int64_t>::max());
+}
+
+TEST_CASE("test timer pool")
+{
+    detail::timer_pool pool;
+
+    auto timer = pool.alloc();
+    auto timer_id = timer->timer_id;
+    CHECK_EQ(pool.find(timer_id), timer);
+
+    // a freed slot is reused with a new generation.
+    pool.free(timer);
+    CHECK_EQ(pool.find(timer_id), nullptr);
+
+    auto reused = pool.alloc();
+    CHECK_EQ(reused, timer);
+    CHECK_NE(reused->timer_id, timer_id);
+    CHECK_EQ(pool.find(reused->timer_id), reused);
+
+    // steady state alloc/free never grows the pool.
+    auto capacity = pool.capacity();
+    for (int i = 0; i < 100000; ++i)
+    {
+        pool.free(pool.alloc());
+    }
+    CHECK_EQ(pool.capacity(), capacity);
+}